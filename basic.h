@@ -7,9 +7,12 @@
 
 #include "util.h"
 #include "board.h"
+#include "rng.h"
+#include "playout.h"
 
 
-bool greedy_move(BoardState *state, eval_func eval) {
+template<typename Eval>
+bool greedy_move(BoardState *state, Eval eval, Rng &rng) {
   auto valid_moves = state->moves();
 
   if (valid_moves.size() == 0) {
@@ -23,10 +26,9 @@ bool greedy_move(BoardState *state, eval_func eval) {
   int best_score = std::numeric_limits<int>::min();
 
   for (auto move : valid_moves) {
-    BoardState next_state(*state);
-    next_state.apply(move);
-
-    int score = eval(&next_state, player);
+    const Undo undo = state->apply(move);
+    int score = eval(state, player, rng);
+    state->undo(undo);
 
     if (score > best_score) {
       best_move = move;
@@ -39,17 +41,16 @@ bool greedy_move(BoardState *state, eval_func eval) {
   return true;
 }
 
-bool random_move(BoardState *state) {
-  auto valid_moves = state->moves();
+bool random_move(BoardState *state, Rng &rng) {
+  const uint64_t valid_moves = state->move_mask();
 
-  if (valid_moves.size() == 0) {
-    state->apply(PASS);
+  if (!valid_moves) {
+    state->apply_pass();
     return false;
   }
 
-  auto move = valid_moves[rand() % valid_moves.size()];
-
-  state->apply(move);
+  const int k = rng.bounded(popcount(valid_moves));
+  state->apply_square(nth_square(valid_moves, k));
 
   return true;
 }
@@ -82,7 +83,7 @@ bool io_move(BoardState *state) {
     int row = int(cmd[1] - '1');
     int col = int(cmd[0] - 'a');
 
-    if (!BOUNDS(row, col)) {
+    if (!on_board(row, col)) {
       cout << "Out of bounds" << endl;
       continue;
     }
@@ -100,14 +101,20 @@ bool io_move(BoardState *state) {
   }
 }
 
+struct RandomPolicy {
+  bool operator()(BoardState *state, Rng &rng) const {
+    return random_move(state, rng);
+  }
+};
+
 template<typename T>
-int rollout_game(const T move_policy_f, BoardState *start_state) {
+int rollout_game(const T move_policy_f, BoardState *start_state, Rng &rng) {
   BoardState state(*start_state);
 
   bool passed = false;
 
   while (true) {
-    bool pass = !move_policy_f(&state);
+    bool pass = !move_policy_f(&state, rng);
 
     if (pass && passed) break;
     passed = pass;
@@ -116,30 +123,40 @@ int rollout_game(const T move_policy_f, BoardState *start_state) {
   return state.winner();
 }
 
-int eval_pieces(BoardState *state, int player) {
-  int s = 0;
-  for (int i = 0; i < BOARD_H; ++i)
-    for (int j = 0; j < BOARD_W; ++j)
-      if (state->board[i][j] == player)
-        ++s;
-  return s;
+int eval_pieces(BoardState *state, int player, Rng &) {
+  return state->count(player);
 }
 
-int eval_inv_pieces(BoardState *state, int player) {
-  int s = 0;
-  for (int i = 0; i < BOARD_H; ++i)
-    for (int j = 0; j < BOARD_W; ++j)
-      if (state->board[i][j] == player)
-        --s;
-  return s;
+int eval_inv_pieces(BoardState *state, int player, Rng &) {
+  return -state->count(player);
 }
 
-int eval_sampling(BoardState *state, int player, int samples) {
-  int s = 0;
-  for (int i = 0; i < samples; ++i) {
-    if (rollout_game(random_move, state) == player) {
-      s++;
-    }
-  }
-  return s;
+// Wins for player in samples random games, spread over pool if given.
+int eval_sampling(BoardState *state, int player, Rng &rng, int samples, ThreadPool *pool = NULL) {
+  return parallel_playouts(state, samples, rng, pool).wins[player];
 }
+
+// The evaluations as types, for the engines templated on them.
+
+struct PiecesEval {
+  int operator()(BoardState *state, int player, Rng &rng) const {
+    return eval_pieces(state, player, rng);
+  }
+};
+
+struct InvPiecesEval {
+  int operator()(BoardState *state, int player, Rng &rng) const {
+    return eval_inv_pieces(state, player, rng);
+  }
+};
+
+struct SamplingEval {
+  int samples;
+  ThreadPool *pool;
+
+  SamplingEval(int samples, ThreadPool *pool) : samples(samples), pool(pool) {}
+
+  int operator()(BoardState *state, int player, Rng &rng) const {
+    return eval_sampling(state, player, rng, samples, pool);
+  }
+};
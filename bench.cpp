@@ -0,0 +1,530 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <cmath>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "board.h"
+#include "util.h"
+#include "minimax.h"
+#include "basic.h"
+#include "uct.h"
+#include "ucb.h"
+#include "playout.h"
+#include "endgame.h"
+#include "pattern.h"
+#include "records.h"
+#include "tournament.h"
+
+using namespace std;
+
+// Benchmarks. By default every suite runs `runs` times and the results
+// are printed as one JSON object, e.g. `./bench 5 > bench_output.txt`.
+
+// Leaf counts of the opening position, depth 1..10.
+const uint64_t PERFT_COUNTS[] = {
+  4, 12, 56, 244, 1396, 8200, 55092, 390216, 3005288, 24571284
+};
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Positions 10..40 plies into random games, the same on every run.
+vector<BoardState> bench_positions(int n) {
+  Rng rng(2024);
+  vector<BoardState> positions;
+
+  while ((int) positions.size() < n) {
+    BoardState state;
+    const int plies = 10 + positions.size() * 30 / n;
+
+    for (int i = 0; i < plies; ++i) {
+      const uint64_t moves = state.move_mask();
+      if (moves) state.apply_square(nth_square(moves, rng.bounded(popcount(moves))));
+      else state.apply_pass();
+    }
+
+    if (state.move_mask()) positions.push_back(state);
+  }
+
+  return positions;
+}
+
+struct Metric {
+  string name;
+  string unit;
+  vector<double> values;
+};
+
+double median(vector<double> v) {
+  sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+double variance(const vector<double> &v) {
+  if (v.size() < 2) return 0;
+  double mean = 0;
+  for (double x : v) mean += x;
+  mean /= v.size();
+  double sum = 0;
+  for (double x : v) sum += (x - mean) * (x - mean);
+  return sum / (v.size() - 1);
+}
+
+void print_json(const vector<Metric> &metrics, int runs) {
+  printf("{\n  \"runs\": %d,\n  \"metrics\": [\n", runs);
+  for (size_t i = 0; i < metrics.size(); ++i) {
+    const Metric &m = metrics[i];
+    printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"median\": %.6g, \"variance\": %.6g, \"values\": [",
+      m.name.c_str(), m.unit.c_str(), median(m.values), variance(m.values));
+    for (size_t j = 0; j < m.values.size(); ++j)
+      printf("%s%.6g", j ? ", " : "", m.values[j]);
+    printf("]}%s\n", i + 1 < metrics.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+// Perft counts must match PERFT_COUNTS; the timed run is depth 9.
+void perft_bench(vector<Metric> &metrics, int runs) {
+  BoardState state;
+  for (int depth = 1; depth <= 10; ++depth) {
+    if (perft(state, depth) != PERFT_COUNTS[depth - 1]) {
+      fprintf(stderr, "perft(%d) = %lu, expected %lu\n", depth,
+        (unsigned long) perft(state, depth), (unsigned long) PERFT_COUNTS[depth - 1]);
+      exit(1);
+    }
+  }
+
+  Metric rate{ "perft_9", "leaves/s", {} };
+  for (int r = 0; r < runs; ++r) {
+    auto start = chrono::steady_clock::now();
+    const uint64_t leaves = perft(state, 9);
+    rate.values.push_back(leaves / seconds_since(start));
+  }
+  metrics.push_back(rate);
+}
+
+// Results stored only so the compiler keeps the work measured.
+volatile uint64_t bench_sink;
+
+// Canonical forms of positions under the board's symmetries.
+void symmetry_bench(vector<Metric> &metrics, int runs) {
+  const vector<BoardState> positions = bench_positions(64);
+  const int rounds = 100000;
+
+  Metric rate{ "canonical_bitboards", "positions/s", {} };
+
+  for (int r = 0; r < runs; ++r) {
+    uint64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      for (const BoardState &state : positions) {
+        uint64_t black = state.black ^ i, white = state.white;
+        sink += canonical_bitboards(black, white) + black;
+      }
+    }
+    rate.values.push_back(rounds * positions.size() / seconds_since(start));
+    bench_sink = sink;
+  }
+
+  metrics.push_back(rate);
+}
+
+void pattern_bench(vector<Metric> &metrics, int runs) {
+  const vector<BoardState> positions = bench_positions(64);
+  const int rounds = 20000;
+
+  // the speed does not depend on the values
+  PatternWeights weights;
+  weights.weights.assign(size_t(PATTERN_PHASES) * pattern_index.phase_size, 1);
+
+  Metric rate{ "pattern_eval", "positions/s", {} };
+
+  for (int r = 0; r < runs; ++r) {
+    uint64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      for (const BoardState &state : positions) {
+        sink += weights.score(state.black & ~uint64_t(i & 1), state.white);
+      }
+    }
+    rate.values.push_back(rounds * positions.size() / seconds_since(start));
+    bench_sink = sink;
+  }
+
+  metrics.push_back(rate);
+}
+
+void records_bench(vector<Metric> &metrics, int runs) {
+  const char *path = "/tmp/reversi_bench.rec";
+  const int games = 50000;
+  Strategy random_player = { "Random", stateless(bind(random_move, placeholders::_1, placeholders::_3)) };
+
+  Metric write{ "self_play_random", "games/s", {} };
+  Metric read{ "read_records", "games/s", {} };
+
+  for (int r = 0; r < runs; ++r) {
+    unlink(path);
+    GameWriter writer;
+    auto start = chrono::steady_clock::now();
+    bool ok = writer.open(path) && self_play(random_player, random_player, games, 1, r, writer, false);
+    ok = writer.close() && ok;
+    write.values.push_back(games / seconds_since(start));
+    assert(ok);
+
+    GameReader reader;
+    GameRecord record;
+    uint64_t moves = 0;
+    start = chrono::steady_clock::now();
+    if (reader.open(path)) {
+      while (reader.next(record)) moves += record.moves.size();
+    }
+    read.values.push_back(games / seconds_since(start));
+    bench_sink = moves;
+  }
+  unlink(path);
+
+  metrics.push_back(write);
+  metrics.push_back(read);
+}
+
+void playout_bench(vector<Metric> &metrics, int runs) {
+  const int games = 100000;
+  BoardState state;
+
+  Metric rollout{ "rollout_game", "playouts/s", {} };
+  Metric kernel{ "random_playout", "playouts/s", {} };
+  Metric batch{ "batch_playouts", "playouts/s", {} };
+  Metric parallel{ "parallel_playouts", "playouts/s", {} };
+
+  ThreadPool pool(max<int>(thread::hardware_concurrency(), 1));
+
+  for (int r = 0; r < runs; ++r) {
+    Rng rng(r);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < games; ++i) rollout_game(RandomPolicy(), &state, rng);
+    rollout.values.push_back(games / seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < games; ++i) random_playout(&state, rng);
+    kernel.values.push_back(games / seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    batch_playouts(&state, games, rng);
+    batch.values.push_back(games / seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    parallel_playouts(&state, games, rng, &pool);
+    parallel.values.push_back(games / seconds_since(start));
+  }
+
+  metrics.push_back(rollout);
+  metrics.push_back(kernel);
+  metrics.push_back(batch);
+  metrics.push_back(parallel);
+}
+
+// Speed of each playout policy from the opening, and its strength per
+// playout: the mean squared error of the mover's win rate over 64
+// playouts against the exact result, on positions with 16 empty squares.
+void policy_bench(vector<Metric> &metrics, int runs) {
+  const int games = 50000, samples = 64;
+  const char *names[] = { "uniform", "corners", "weighted" };
+
+  vector<BoardState> positions;
+  vector<double> results;
+  EndgameSolver solver;
+  Rng position_rng(25);
+  while (positions.size() < 32) {
+    BoardState state;
+    while (popcount(state.empty()) > 16) random_move(&state, position_rng);
+    if (!state.move_mask()) continue;
+    const int winner = solver.winner(state);
+    positions.push_back(state);
+    results.push_back(winner == state.active_player ? 1 : winner == EMPTY ? 0.5 : 0);
+  }
+
+  for (const Playout policy : { PLAYOUT_UNIFORM, PLAYOUT_CORNERS, PLAYOUT_WEIGHTED }) {
+    Metric rate{ string("playout_") + names[policy], "playouts/s", {} };
+    Metric error{ string("playout_") + names[policy] + "_error", "mse", {} };
+    BoardState opening;
+
+    for (int r = 0; r < runs; ++r) {
+      Rng rng(r);
+      uint64_t sink = 0;
+      auto start = chrono::steady_clock::now();
+      for (int i = 0; i < games; ++i) sink += playout(&opening, rng, policy);
+      rate.values.push_back(games / seconds_since(start));
+      bench_sink = sink;
+
+      double squared = 0;
+      for (size_t i = 0; i < positions.size(); ++i) {
+        double score = 0;
+        for (int k = 0; k < samples; ++k) {
+          const int winner = playout(&positions[i], rng, policy);
+          score += winner == positions[i].active_player ? 1 : winner == EMPTY ? 0.5 : 0;
+        }
+        squared += pow(score / samples - results[i], 2);
+      }
+      error.values.push_back(squared / positions.size());
+    }
+
+    metrics.push_back(rate);
+    metrics.push_back(error);
+  }
+}
+
+void uct_bench(vector<Metric> &metrics, int runs) {
+  const int n_playouts = 20000;
+  const vector<BoardState> positions = bench_positions(5);
+
+  Metric rate{ "uct_search", "playouts/s", {} };
+  Metric nodes{ "uct_nodes", "nodes/s", {} };
+  Metric memory{ "uct_tree_memory", "bytes", {} };
+  Metric rave{ "uct_rave_search", "playouts/s", {} };
+
+  for (int r = 0; r < runs; ++r) {
+    double secs = 0, rave_secs = 0;
+    size_t n_nodes = 0, bytes = 0;
+
+    for (size_t i = 0; i < positions.size(); ++i) {
+      Rng rng(r * positions.size() + i);
+      auto start = chrono::steady_clock::now();
+      UctTree tree(positions[i], uct_capacity(n_playouts));
+      tree.search(n_playouts, 1, rng);
+      secs += seconds_since(start);
+      n_nodes += tree.nodes.size;
+      bytes += tree.memory_used();
+
+      start = chrono::steady_clock::now();
+      UctTree rave_tree(positions[i], uct_capacity(n_playouts), true, true);
+      rave_tree.search(n_playouts, 1, rng);
+      rave_secs += seconds_since(start);
+    }
+
+    rate.values.push_back(n_playouts * positions.size() / secs);
+    nodes.values.push_back(n_nodes / secs);
+    memory.values.push_back(double(bytes) / positions.size());
+    rave.values.push_back(n_playouts * positions.size() / rave_secs);
+  }
+
+  metrics.push_back(rate);
+  metrics.push_back(nodes);
+  metrics.push_back(memory);
+  metrics.push_back(rave);
+}
+
+void minimax_bench(vector<Metric> &metrics, int runs) {
+  const double move_seconds = 0.1;
+  const vector<BoardState> positions = bench_positions(5);
+
+  Metric rate{ "minimax_nodes", "nodes/s", {} };
+  Metric depth{ "minimax_depth", "plies", {} };
+
+  Rng rng(8);
+
+  for (int r = 0; r < runs; ++r) {
+    double secs = 0;
+    uint64_t n_nodes = 0;
+    double depths = 0;
+
+    for (const BoardState &position : positions) {
+      BoardState state(position);
+      MinimaxSearch<PiecesEval> search;
+
+      auto start = chrono::steady_clock::now();
+      search.search(&state, 60, rng, Deadline(TimeControl(move_seconds), popcount(state.empty())));
+      secs += seconds_since(start);
+      n_nodes += search.nodes;
+      depths += search.depth_reached;
+    }
+
+    rate.values.push_back(n_nodes / secs);
+    depth.values.push_back(depths / positions.size());
+  }
+
+  metrics.push_back(rate);
+  metrics.push_back(depth);
+}
+
+// Root solves of random positions with 14 empty squares, win/loss/draw
+// and exact.
+void endgame_bench(vector<Metric> &metrics, int runs) {
+  const int n_positions = 10;
+  const int empties = 14;
+
+  vector<BoardState> positions;
+  Rng rng(14);
+  while ((int) positions.size() < n_positions) {
+    BoardState state;
+    while (popcount(state.empty()) > empties && !(state.passed && !state.move_mask())) {
+      random_move(&state, rng);
+    }
+    if (state.move_mask()) positions.push_back(state);
+  }
+
+  Metric wld{ "endgame_wld_14", "ms", {} };
+  Metric exact{ "endgame_exact_14", "ms", {} };
+  Metric rate{ "endgame_nodes", "nodes/s", {} };
+
+  EndgameSolver solver;
+
+  for (int r = 0; r < runs; ++r) {
+    solver.nodes = 0;
+    auto start = chrono::steady_clock::now();
+    for (const BoardState &state : positions) solver.best_move(state, false);
+    wld.values.push_back(1000 * seconds_since(start) / n_positions);
+
+    start = chrono::steady_clock::now();
+    for (const BoardState &state : positions) solver.best_move(state, true);
+    const double secs = seconds_since(start);
+    exact.values.push_back(1000 * secs / n_positions);
+    rate.values.push_back(solver.nodes / (secs + wld.values.back() * n_positions / 1000));
+  }
+
+  metrics.push_back(wld);
+  metrics.push_back(exact);
+  metrics.push_back(rate);
+}
+
+// Table hit rate and tree size with and without transpositions, for a
+// fixed playout budget per position.
+void uct_table_perf(int n_playouts, int positions) {
+  Rng rng(11);
+  size_t plain_nodes = 0, shared_nodes = 0;
+  double hit_rate = 0;
+
+  for (int i = 0; i < positions; ++i) {
+    BoardState state;
+    for (int j = 0; j < (i * 7) % 30; ++j) {
+      random_move(&state, rng);
+    }
+
+    UctTree plain(state, n_playouts * UCT_NODES_PER_PLAYOUT, false);
+    UctTree shared(state, n_playouts * UCT_NODES_PER_PLAYOUT, true);
+    Rng r1(i), r2(i);
+    plain.search(n_playouts, 1, r1);
+    shared.search(n_playouts, 1, r2);
+
+    plain_nodes += plain.nodes.size;
+    shared_nodes += shared.nodes.size;
+    hit_rate += shared.table.hit_rate();
+  }
+
+  printf("%d playouts: table hit rate %.1f%%, %zu nodes -> %zu nodes (%.1f%% fewer)\n",
+    n_playouts, 100 * hit_rate / positions, plain_nodes / positions, shared_nodes / positions,
+    100.0 * (plain_nodes - shared_nodes) / plain_nodes);
+}
+
+// Playout rate of parallel UCT from the opening, and its win rate against
+// single-threaded UCT. Each thread adds n_trials to the parallel player's
+// budget, so the match compares equal wall-clock time on ideal scaling.
+void uct_scaling_perf(int n_trials, int games) {
+  const int thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+  Rng rng(12);
+
+  for (int n_threads : thread_counts) {
+    BoardState state;
+    const int moves = state.moves().size();
+    const int playouts = n_trials * n_threads * moves;
+
+    auto start = chrono::steady_clock::now();
+    uct_move(&state, n_trials * n_threads, n_threads, rng);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int wins = 0;
+    for (int g = 0; g < games; ++g) {
+      BoardState game;
+      const int parallel_player = (g % 2) ? WHITE : BLACK;
+
+      bool passed = false;
+      while (true) {
+        bool pass = game.active_player == parallel_player
+          ? !uct_move(&game, n_trials * n_threads, n_threads, rng)
+          : !uct_move(&game, n_trials, 1, rng);
+        if (pass && passed) break;
+        passed = pass;
+      }
+
+      wins += game.winner() == parallel_player;
+    }
+
+    printf("threads %2d: %10.0f playouts/s, %d/%d wins vs 1 thread\n",
+      n_threads, playouts / secs, wins, games);
+  }
+}
+
+
+template<int N>
+Metric sized_playout_metric(const char *name, int runs) {
+  const int games = 20000;
+  Metric rate{ name, "games/s", {} };
+
+  for (int r = 0; r < runs; ++r) {
+    Rng rng(r);
+    uint64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    const Board<N> opening;
+    for (int i = 0; i < games; ++i) sink += random_playout(&opening, rng);
+    rate.values.push_back(games / seconds_since(start));
+    bench_sink = sink;
+  }
+
+  return rate;
+}
+
+// Random games on the other board sizes, and on 8x8 for comparison.
+void sized_bench(vector<Metric> &metrics, int runs) {
+  metrics.push_back(sized_playout_metric<6>("sized_playout_6", runs));
+  metrics.push_back(sized_playout_metric<8>("sized_playout_8", runs));
+  metrics.push_back(sized_playout_metric<10>("sized_playout_10", runs));
+}
+
+int main(int argc, char ** argv) {
+
+  if (argc > 1 && string(argv[1]) == "uct-table") {
+    int n_playouts = argc > 2 ? stoi(argv[2]) : 10000;
+    int positions = argc > 3 ? stoi(argv[3]) : 20;
+    uct_table_perf(n_playouts, positions);
+    return 0;
+  }
+
+  if (argc > 1 && string(argv[1]) == "uct-scaling") {
+    int n_trials = argc > 2 ? stoi(argv[2]) : 100;
+    int games = argc > 3 ? stoi(argv[3]) : 20;
+    uct_scaling_perf(n_trials, games);
+    return 0;
+  }
+
+  int runs = argc > 1 ? stoi(argv[1]) : 5;
+
+  vector<Metric> metrics;
+
+  perft_bench(metrics, runs);
+
+  symmetry_bench(metrics, runs);
+
+  pattern_bench(metrics, runs);
+
+  records_bench(metrics, runs);
+
+  sized_bench(metrics, runs);
+
+  playout_bench(metrics, runs);
+
+  policy_bench(metrics, runs);
+
+  uct_bench(metrics, runs);
+
+  minimax_bench(metrics, runs);
+
+  endgame_bench(metrics, runs);
+
+  print_json(metrics, runs);
+}
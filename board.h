@@ -1,171 +1,566 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <type_traits>
 
 #include "util.h"
 
-struct BoardState {
+// Boards are N x N for any even N from 4 to 10 (Board<N>); the engines
+// play on BoardState, the 8x8 board. Square (y, x) is bit y * N + x of a
+// uint64_t, or of an unsigned __int128 above 8x8. A shift by d moves
+// every disc one step in one direction; discs that would wrap around a
+// file edge are removed by masking the "through" pieces with the inner
+// files. Every mask and table of a size is computed from N by constexpr
+// code, so each size gets its own fully specialized kernels.
+
+__extension__ typedef unsigned __int128 uint128;
+
+template<int N>
+using board_bits = typename std::conditional<(N * N <= 64), uint64_t, uint128>::type;
+
+// Squares of the largest board.
+const int MAX_SQUARES = 100;
+
+// No square, e.g. no move found yet.
+const uint8_t NO_MOVE = 0xFF;
+
+template<typename B = uint64_t>
+inline B square_bit(const int sq) {
+  return B(1) << sq;
+}
+
+inline int popcount(const uint64_t b) {
+  return __builtin_popcountll(b);
+}
+
+inline int popcount(const uint128 b) {
+  return __builtin_popcountll(uint64_t(b)) + __builtin_popcountll(uint64_t(b >> 64));
+}
+
+inline int lowest_square(const uint64_t b) {
+  return __builtin_ctzll(b);
+}
+
+inline int lowest_square(const uint128 b) {
+  return uint64_t(b) ? __builtin_ctzll(uint64_t(b)) : 64 + __builtin_ctzll(uint64_t(b >> 64));
+}
+
+// Square of the k-th (from zero) set bit of b.
+template<typename B>
+inline int nth_square(B b, int k) {
+  while (k--) b &= b - 1;
+  return lowest_square(b);
+}
+
+// Masks of an N x N board: all its squares, the squares off the edge
+// files (which runs may pass through in a direction with a sideways
+// step), the corners, quadrants, lines and the neighbours of each square.
+template<int N>
+struct BoardGeometry {
+  typedef board_bits<N> Bits;
+
+  Bits all;
+  Bits inner_files;
+  Bits corners;
+  Bits quadrants[4];
+  Bits rows[N];
+  Bits columns[N];
+  Bits diagonals[2 * (2 * N - 1)];  // down and up lines, alternating
+  Bits neighbours[N * N];
+
+  constexpr BoardGeometry()
+      : all(0), inner_files(0), corners(0), quadrants(), rows(), columns(), diagonals(), neighbours() {
+    for (int y = 0; y < N; ++y) {
+      for (int x = 0; x < N; ++x) {
+        const Bits bit = Bits(1) << (y * N + x);
+        all |= bit;
+        rows[y] |= bit;
+        columns[x] |= bit;
+        quadrants[2 * (y >= N / 2) + (x >= N / 2)] |= bit;
+        if (x > 0 && x < N - 1) inner_files |= bit;
+        if ((x == 0 || x == N - 1) && (y == 0 || y == N - 1)) corners |= bit;
+        diagonals[2 * (x - y + N - 1)] |= bit;
+        diagonals[2 * (x + y) + 1] |= bit;
+
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            const int ny = y + dy, nx = x + dx;
+            if ((dy || dx) && ny >= 0 && ny < N && nx >= 0 && nx < N) {
+              neighbours[y * N + x] |= Bits(1) << (ny * N + nx);
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+template<int N>
+constexpr BoardGeometry<N> GEOMETRY = BoardGeometry<N>();
+
+template<int N = 8>
+inline bool on_board(const int y, const int x) {
+  return y >= 0 && y < N && x >= 0 && x < N;
+}
+
+// Call f(y2, x2) for every square next to (y, x).
+template<int N = 8, typename T>
+inline void map_adjacent(const int y, const int x, const T f) {
+  for (board_bits<N> b = GEOMETRY<N>.neighbours[y * N + x]; b; b &= b - 1) {
+    const int sq = lowest_square(b);
+    f(sq / N, sq % N);
+  }
+}
+
+template<int N = 8>
+std::vector<Point> adjacent(const int y, const int x) {
+  std::vector<Point> adj;
+  map_adjacent<N>(y, x, [&](int y2, int x2) { adj.emplace_back(y2, x2); });
+  return adj;
+}
+
+// The fills below are written over a bitboard type B, so they run on a
+// single uint64_t or uint128 as well as on a vector of lanes (see
+// playout.h).
+
+// f where test has any bit set, else zero.
+inline uint64_t select_nonzero(const uint64_t f, const uint64_t test) {
+  return test ? f : 0;
+}
+
+inline uint128 select_nonzero(const uint128 f, const uint128 test) {
+  return test ? f : 0;
+}
+
+// Lane-wise version for GCC vectors of bitboards.
+template<typename V>
+inline V select_nonzero(const V f, const V test) {
+  return f & V(test != 0);
+}
+
+template<int D, typename B>
+inline B shift(const B b) {
+  return D > 0 ? b << (D > 0 ? D : 0) : b >> (D < 0 ? -D : 0);
+}
+
+// Discs of o that may be passed through in direction D.
+template<int N, int D, typename B>
+inline B through_mask(const B o) {
+  return (D == N || D == -N) ? o : o & GEOMETRY<N>.inner_files;
+}
+
+// Empty squares reached from p over a contiguous run of o in direction D.
+// Runs are at most N - 2 discs long, so N - 3 fill steps follow the first.
+template<int N, int D, typename B>
+inline B moves_in_direction(const B p, const B o, const B empty) {
+  const B mask = through_mask<N, D>(o);
+
+  B x = mask & shift<D>(p);
+  for (int i = 0; i < N - 3; ++i) x |= mask & shift<D>(x);
+
+  return empty & shift<D>(x);
+}
+
+// Discs of o bracketed between square m and a disc of p in direction D.
+template<int N, int D, typename B>
+inline B flips_in_direction(const B m, const B p, const B o) {
+  const B mask = through_mask<N, D>(o);
+
+  B f = mask & shift<D>(m);
+  for (int i = 0; i < N - 3; ++i) f |= mask & shift<D>(f);
+
+  return select_nonzero(f, shift<D>(f) & p);
+}
+
+// Legal moves for the player owning p against o on an N x N board, for
+// all squares at once.
+template<int N = 8, typename B>
+inline B move_mask(const B p, const B o) {
+  const B empty = ~(p | o) & GEOMETRY<N>.all;
+
+  return moves_in_direction<N, 1>(p, o, empty) | moves_in_direction<N, -1>(p, o, empty)
+       | moves_in_direction<N, N>(p, o, empty) | moves_in_direction<N, -N>(p, o, empty)
+       | moves_in_direction<N, N + 1>(p, o, empty) | moves_in_direction<N, -N - 1>(p, o, empty)
+       | moves_in_direction<N, N - 1>(p, o, empty) | moves_in_direction<N, -N + 1>(p, o, empty);
+}
+
+// Discs of o flipped when the owner of p plays on the square(s) in m.
+template<int N = 8, typename B>
+inline B flip_mask(const B m, const B p, const B o) {
+  return flips_in_direction<N, 1>(m, p, o) | flips_in_direction<N, -1>(m, p, o)
+       | flips_in_direction<N, N>(m, p, o) | flips_in_direction<N, -N>(m, p, o)
+       | flips_in_direction<N, N + 1>(m, p, o) | flips_in_direction<N, -N - 1>(m, p, o)
+       | flips_in_direction<N, N - 1>(m, p, o) | flips_in_direction<N, -N + 1>(m, p, o);
+}
+
+// The eight symmetries of the board. Symmetry t transposes (bit 2), then
+// mirrors the files (bit 0), then flips the ranks (bit 1).
+
+inline uint64_t flip_ranks(const uint64_t b) {
+  return __builtin_bswap64(b);
+}
+
+inline uint64_t mirror_files(uint64_t b) {
+  b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+  b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+  return ((b >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((b & 0x0F0F0F0F0F0F0F0FULL) << 4);
+}
+
+// Swap files and ranks (mirror in the a1-h8 diagonal) by delta swaps.
+inline uint64_t transpose(uint64_t b) {
+  uint64_t t;
+  t = 0x0F0F0F0F00000000ULL & (b ^ (b << 28));
+  b ^= t ^ (t >> 28);
+  t = 0x3333000033330000ULL & (b ^ (b << 14));
+  b ^= t ^ (t >> 14);
+  t = 0x5500550055005500ULL & (b ^ (b << 7));
+  b ^= t ^ (t >> 7);
+  return b;
+}
+
+inline uint64_t transform_bitboard(uint64_t b, const int t) {
+  if (t & 4) b = transpose(b);
+  if (t & 1) b = mirror_files(b);
+  if (t & 2) b = flip_ranks(b);
+  return b;
+}
+
+inline int transform_square(const int sq, const int t) {
+  int y = sq >> 3, x = sq & 7;
+  if (t & 4) std::swap(x, y);
+  if (t & 1) x = 7 - x;
+  if (t & 2) y = 7 - y;
+  return y * 8 + x;
+}
+
+inline int inverse_transform_square(const int sq, const int t) {
+  int y = sq >> 3, x = sq & 7;
+  if (t & 2) y = 7 - y;
+  if (t & 1) x = 7 - x;
+  if (t & 4) std::swap(x, y);
+  return y * 8 + x;
+}
+
+// The symmetry t giving the smallest image (by a, then b) of the pair of
+// bitboards a and b, which are replaced by that image.
+inline int canonical_bitboards(uint64_t &a, uint64_t &b) {
+  uint64_t images_a[8], images_b[8];
+
+  images_a[0] = a;
+  images_b[0] = b;
+  images_a[4] = transpose(a);
+  images_b[4] = transpose(b);
+
+  for (int base = 0; base < 8; base += 4) {
+    images_a[base + 1] = mirror_files(images_a[base]);
+    images_b[base + 1] = mirror_files(images_b[base]);
+    images_a[base + 2] = flip_ranks(images_a[base]);
+    images_b[base + 2] = flip_ranks(images_b[base]);
+    images_a[base + 3] = flip_ranks(images_a[base + 1]);
+    images_b[base + 3] = flip_ranks(images_b[base + 1]);
+  }
+
+  int best = 0;
+  for (int t = 1; t < 8; ++t) {
+    if (images_a[t] < images_a[best] || (images_a[t] == images_a[best] && images_b[t] < images_b[best])) {
+      best = t;
+    }
+  }
+
+  a = images_a[best];
+  b = images_b[best];
+  return best;
+}
+
+// Zobrist keys, generated at compile time with splitmix64. A position's
+// hash is the xor of the keys of its discs, plus side_to_move when white
+// is to play and passed after a pass. The keys of squares past the 8x8
+// board come last, so 8x8 hashes do not depend on them.
+struct ZobristKeys {
+  uint64_t disc[3][MAX_SQUARES];
+  uint64_t flip[MAX_SQUARES];
+  uint64_t side_to_move;
+  uint64_t passed;
+
+  static constexpr uint64_t splitmix(uint64_t &x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  constexpr ZobristKeys() : disc(), flip(), side_to_move(0), passed(0) {
+    uint64_t x = 0x5EED;
+    for (int sq = 0; sq < 64; ++sq) {
+      disc[BLACK][sq] = splitmix(x);
+      disc[WHITE][sq] = splitmix(x);
+      flip[sq] = disc[BLACK][sq] ^ disc[WHITE][sq];
+    }
+    side_to_move = splitmix(x);
+    passed = splitmix(x);
+    for (int sq = 64; sq < MAX_SQUARES; ++sq) {
+      disc[BLACK][sq] = splitmix(x);
+      disc[WHITE][sq] = splitmix(x);
+      flip[sq] = disc[BLACK][sq] ^ disc[WHITE][sq];
+    }
+  }
+};
+
+constexpr ZobristKeys ZOBRIST;
+
+// What it takes to take back a move: the discs it flipped, the square
+// it was played on (NO_MOVE for a pass), and the hash and pass flag it
+// replaced.
+template<typename Bits>
+struct BoardUndo {
+  Bits flips;
+  uint64_t hash;
+  uint8_t square;
+  bool passed;
+};
+
+typedef BoardUndo<uint64_t> Undo;
+
+template<int N>
+struct Board {
+  static_assert(N % 2 == 0 && N >= 4 && N <= 10, "boards are even, from 4x4 to 10x10");
 
-  int board[BOARD_H][BOARD_W];
+  typedef board_bits<N> Bits;
+  typedef BoardUndo<Bits> Undo;
+
+  Bits black;
+  Bits white;
+  uint64_t hash;
   int active_player;
   bool passed;
 
-  BoardState() : active_player(BLACK) {
-    std::fill(*board, board[BOARD_H - 1]+BOARD_W, 0);
+  Board() : black(0), white(0), hash(0), active_player(BLACK) {
     passed = false;
 
-    int mid_h = BOARD_H / 2 - 1;
-    int mid_w = BOARD_W / 2 - 1;
+    int mid = N / 2 - 1;
 
-    board[mid_h][mid_w] = WHITE;
-    board[mid_h][mid_w+1] = BLACK;
-    board[mid_h+1][mid_w] = BLACK;
-    board[mid_h+1][mid_w+1] = WHITE;
+    set(mid, mid, WHITE);
+    set(mid, mid+1, BLACK);
+    set(mid+1, mid, BLACK);
+    set(mid+1, mid+1, WHITE);
   }
 
-  BoardState(const BoardState & other) {
-    active_player = other.active_player;
-    passed = other.passed;
-    std::copy(*other.board, other.board[BOARD_H - 1]+BOARD_W, *board);
+  inline Bits pieces(const int player) const {
+    return player == BLACK ? black : white;
   }
 
-  inline int get(const int r, const int c) {
-    return board[r][c];
+  inline Bits & pieces(const int player) {
+    return player == BLACK ? black : white;
   }
 
-  inline void set(const int r, const int c, const int player) {
-    board[r][c] = player;
+  inline Bits empty() const {
+    return ~(black | white) & GEOMETRY<N>.all;
   }
 
-  void apply(const Point move) {
-    if (move == PASS) {
-      passed = true;
-    } else {
-      passed = false;
-      assert(board[move.first][move.second] == EMPTY);
-      board[move.first][move.second] = active_player;
+  inline int get(const int r, const int c) const {
+    const Bits b = square_bit<Bits>(r * N + c);
+    if (black & b) return BLACK;
+    if (white & b) return WHITE;
+    return EMPTY;
+  }
 
-      auto f = [&](int y, int x){
-        if (board[y][x] == OTHER(active_player)) {
+  inline void set(const int r, const int c, const int player) {
+    const int sq = r * N + c;
+    const Bits b = square_bit<Bits>(sq);
+    hash ^= ZOBRIST.disc[get(r, c)][sq] ^ ZOBRIST.disc[player][sq];
+    black &= ~b;
+    white &= ~b;
+    if (player == BLACK) black |= b;
+    if (player == WHITE) white |= b;
+  }
 
-          const int dx = x - move.second;
-          const int dy = y - move.first;
+  // The hash of the position from scratch; apply() keeps hash equal to it.
+  uint64_t compute_hash() const {
+    uint64_t h = 0;
+    for (Bits b = black; b; b &= b - 1) h ^= ZOBRIST.disc[BLACK][lowest_square(b)];
+    for (Bits b = white; b; b &= b - 1) h ^= ZOBRIST.disc[WHITE][lowest_square(b)];
+    if (active_player == WHITE) h ^= ZOBRIST.side_to_move;
+    if (passed) h ^= ZOBRIST.passed;
+    return h;
+  }
 
-          while (true) {
-            x += dx;
-            y += dy;
+  inline int count(const int player) const {
+    return popcount(pieces(player));
+  }
 
-            if (!BOUNDS(y, x)) break;
+  inline Bits move_mask() const {
+    return ::move_mask<N>(pieces(active_player), pieces(OTHER(active_player)));
+  }
 
-            if (board[y][x] == active_player) {
-              while (true) {
-                x -= dx;
-                y -= dy;
+  // Whether the active player may play on sq; squares away from the
+  // opponent's discs are ruled out by the neighbour table alone.
+  bool legal(const int sq) const {
+    const Bits m = square_bit<Bits>(sq);
+    const Bits o = pieces(OTHER(active_player));
+    if (!(empty() & m) || !(GEOMETRY<N>.neighbours[sq] & o)) return false;
+    return ::flip_mask<N>(m, pieces(active_player), o) != 0;
+  }
 
-                if (board[y][x] == active_player)
-                  break;
+  // Place a disc for the active player on sq (a legal move) and pass the
+  // turn. The returned record lets undo() take the move back.
+  inline Undo apply_square(const int sq) {
+    Bits & p = pieces(active_player);
+    Bits & o = pieces(OTHER(active_player));
+    const Bits m = square_bit<Bits>(sq);
 
-                board[y][x] = active_player;
-              }
-              break;
-            }
+    assert(!((black | white) & m));
+    const Bits flips = ::flip_mask<N>(m, p, o);
+    const Undo undo = { flips, hash, uint8_t(sq), passed };
 
-            if (board[y][x] == EMPTY) {
-              break;
-            }
-          }
-        }
-      };
+    p |= flips | m;
+    o &= ~flips;
 
-      map_adjacent(move.first, move.second, f);
-    }
+    hash ^= ZOBRIST.disc[active_player][sq] ^ ZOBRIST.side_to_move;
+    for (Bits b = flips; b; b &= b - 1)
+      hash ^= ZOBRIST.flip[lowest_square(b)];
+    if (passed) hash ^= ZOBRIST.passed;
 
+    passed = false;
     active_player = OTHER(active_player);
+
+    return undo;
   }
 
-  std::vector<Point> moves() const {
-    std::vector<Point> m;
-    m.reserve(60);
-  
-    for (int i = 0; i < BOARD_H; ++i) {
-      for (int j = 0; j < BOARD_W; ++j) {
-        if (board[i][j] == active_player) {
+  inline Undo apply_pass() {
+    const Undo undo = { 0, hash, NO_MOVE, passed };
 
-          auto f = [&](int y, int x){
-            if (board[y][x] == OTHER(active_player)) {
+    hash ^= ZOBRIST.side_to_move;
+    if (!passed) hash ^= ZOBRIST.passed;
 
-              const int dx = x - j;
-              const int dy = y - i;
+    passed = true;
+    active_player = OTHER(active_player);
 
-              while (true) {
-                x += dx;
-                y += dy;
+    return undo;
+  }
 
-                if (!BOUNDS(y, x)) break;
+  Undo apply(const Point move) {
+    if (move == PASS) {
+      return apply_pass();
+    } else {
+      return apply_square(move.first * N + move.second);
+    }
+  }
 
-                if (board[y][x] == active_player) break;
+  // Restore the position before the move that returned undo, which must
+  // be the last move applied.
+  inline void undo(const Undo &undo) {
+    active_player = OTHER(active_player);
 
-                if (board[y][x] == EMPTY) {
-                  m.emplace_back(y, x);
-                  break;
-                }
-              }
-            }
-          };
+    if (undo.square != NO_MOVE) {
+      pieces(active_player) &= ~(undo.flips | square_bit<Bits>(undo.square));
+      pieces(OTHER(active_player)) |= undo.flips;
+    }
 
-          map_adjacent(i, j, f);
-        }
-      }
+    hash = undo.hash;
+    passed = undo.passed;
+  }
+
+  std::vector<Point> moves() const {
+    std::vector<Point> m;
+    m.reserve(32);
+
+    for (Bits mask = move_mask(); mask; mask &= mask - 1) {
+      const int sq = lowest_square(mask);
+      m.emplace_back(sq / N, sq % N);
     }
 
-    return move(m);
+    return m;
   }
 
   void print() {
-    auto valid_moves = moves();
+    const Bits valid_moves = move_mask();
 
-    printf(" ");
-    for (int i = 0; i < BOARD_W; ++i)
+    printf(N > 9 ? "  " : " ");
+    for (int i = 0; i < N; ++i)
       printf("  %c", 'a' + i);
     printf("\n\n");
 
-    for (int i = 0; i < BOARD_H; ++i) {
-      printf("%d", i+1);
-      for (int j = 0; j < BOARD_W; ++j) {
-        if (board[i][j] == WHITE)
+    for (int i = 0; i < N; ++i) {
+      printf(N > 9 ? "%2d" : "%d", i+1);
+      for (int j = 0; j < N; ++j) {
+        if (get(i, j) == WHITE)
           printf("  \u25CB");
-        else if (board[i][j] == BLACK)
+        else if (get(i, j) == BLACK)
           printf("  \u25CF");
-        else {
-          Point x(i, j);
-
-          if (std::find(valid_moves.begin(), valid_moves.end(), x) != valid_moves.end())
-            printf("  _");
-          else 
-            printf("  .");
-        }
+        else if (valid_moves & square_bit<Bits>(i * N + j))
+          printf("  _");
+        else
+          printf("  .");
       }
       printf("\n\n");
     }
   }
 
-  int winner() {
-    assert(passed);
+  bool operator==(const Board &other) const {
+    return black == other.black && white == other.white
+        && active_player == other.active_player && passed == other.passed;
+  }
 
-    int w_score = 0;
-    int b_score = 0;
+  int winner() const {
+    assert(passed);
 
-    for (int i = 0; i < BOARD_H; ++i) {
-      for (int j = 0; j < BOARD_W; ++j) {
-        if (board[i][j] == WHITE)
-          w_score++;
-        else if (board[i][j] == BLACK)
-          b_score++;
-      }
-    }
+    int w_score = count(WHITE);
+    int b_score = count(BLACK);
 
     if (w_score > b_score) return WHITE;
     if (w_score < b_score) return BLACK;
     return EMPTY;
   }
-};
\ No newline at end of file
+};
+
+// The board the engines play on.
+typedef Board<8> BoardState;
+
+// The symmetric image of state with the smallest (black, white) boards,
+// with its hash recomputed. *transform receives the symmetry, so a move
+// sq in the image is inverse_transform_square(sq, t) in state.
+inline BoardState canonical_position(const BoardState &state, int *transform = NULL) {
+  BoardState image(state);
+  const int t = canonical_bitboards(image.black, image.white);
+  if (t) image.hash = image.compute_hash();
+  if (transform) *transform = t;
+  return image;
+}
+
+// Number of positions depth plies below state, where a forced pass counts
+// as a ply and a finished game as a leaf, walking the tree in place with
+// apply and undo.
+template<int N>
+uint64_t perft_walk(Board<N> &state, const int depth) {
+  if (depth == 0) return 1;
+
+  board_bits<N> valid_moves = state.move_mask();
+
+  if (!valid_moves) {
+    if (state.passed) return 1;
+    const auto undo = state.apply_pass();
+    const uint64_t n = perft_walk(state, depth - 1);
+    state.undo(undo);
+    return n;
+  }
+
+  if (depth == 1) return popcount(valid_moves);
+
+  uint64_t n = 0;
+  for (; valid_moves; valid_moves &= valid_moves - 1) {
+    const auto undo = state.apply_square(lowest_square(valid_moves));
+    n += perft_walk(state, depth - 1);
+    state.undo(undo);
+  }
+  return n;
+}
+
+// Checks move generation against the published counts for the opening
+// position.
+template<int N>
+uint64_t perft(Board<N> state, const int depth) {
+  return perft_walk(state, depth);
+}
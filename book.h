@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "board.h"
+#include "rng.h"
+#include "records.h"
+
+// Opening book file: a BookHeader followed by header.count BookEntry
+// records sorted by (key, move). The key is the hash of the position's
+// canonical_position, and move is in that same orientation.
+
+const char BOOK_MAGIC[4] = { 'R', 'B', 'O', 'K' };
+const uint32_t BOOK_VERSION = 1;
+
+struct BookHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+struct BookEntry {
+  uint64_t key;
+  uint32_t games;
+  uint32_t points;  // two per win and one per draw, for the player moving
+  uint8_t move;
+  uint8_t reserved[7];
+};
+
+static_assert(sizeof(BookHeader) == 16 && sizeof(BookEntry) == 24, "book records are written as is");
+
+// A book file mapped read-only into memory.
+struct OpeningBook {
+  const BookEntry *entries;
+  size_t count;
+  void *map;
+  size_t map_size;
+
+  OpeningBook() : entries(NULL), count(0), map(NULL), map_size(0) {}
+
+  ~OpeningBook() {
+    if (map) munmap(map, map_size);
+  }
+
+  OpeningBook(const OpeningBook &) = delete;
+  OpeningBook & operator=(const OpeningBook &) = delete;
+
+  // False if path is missing or not a book.
+  bool load(const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(BookHeader)) {
+      close(fd);
+      return false;
+    }
+
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return false;
+
+    const BookHeader *header = static_cast<const BookHeader *>(m);
+    if (std::memcmp(header->magic, BOOK_MAGIC, 4) != 0 || header->version != BOOK_VERSION
+        || sizeof(BookHeader) + header->count * sizeof(BookEntry) != size_t(st.st_size)) {
+      munmap(m, st.st_size);
+      return false;
+    }
+
+    if (map) munmap(map, map_size);
+    map = m;
+    map_size = st.st_size;
+    entries = reinterpret_cast<const BookEntry *>(header + 1);
+    count = header->count;
+
+    return true;
+  }
+
+  // The book's move for state (with at least min_games games and the best
+  // score among those), or NO_MOVE.
+  uint8_t move(const BoardState &state, const uint32_t min_games) const {
+    int t;
+    const uint64_t key = canonical_position(state, &t).hash;
+
+    const BookEntry *first = std::lower_bound(entries, entries + count, key,
+      [](const BookEntry &e, uint64_t k) { return e.key < k; });
+
+    const BookEntry *best = NULL;
+    for (const BookEntry *e = first; e < entries + count && e->key == key; ++e) {
+      if (e->games < min_games) continue;
+      if (!best || uint64_t(e->points) * best->games > uint64_t(best->points) * e->games) best = e;
+    }
+
+    if (!best) return NO_MOVE;
+
+    const int sq = inverse_transform_square(best->move, t);
+    return (state.move_mask() & square_bit(sq)) ? sq : NO_MOVE;
+  }
+};
+
+// Book consulted by the search engines before searching, if loaded.
+OpeningBook opening_book;
+
+const uint32_t BOOK_MIN_GAMES = 4;
+
+inline uint8_t book_move(const BoardState &state) {
+  if (!opening_book.count) return NO_MOVE;
+  return opening_book.move(state, BOOK_MIN_GAMES);
+}
+
+// Book from the first plies of every game read from reader.
+std::vector<BookEntry> build_book(GameReader &reader, int plies) {
+  std::map<std::pair<uint64_t, uint8_t>, BookEntry> merged;
+
+  GameRecord record;
+  while (reader.next(record)) {
+    const int winner = record.score > 0 ? BLACK : record.score < 0 ? WHITE : EMPTY;
+    int ply = 0;
+
+    replay(record, [&](const BoardState &before, uint8_t move) {
+      if (ply++ >= plies || move == RECORD_PASS) return;
+
+      int t;
+      const uint64_t key = canonical_position(before, &t).hash;
+      BookEntry &e = merged[std::make_pair(key, uint8_t(transform_square(move, t)))];
+      e.key = key;
+      e.move = transform_square(move, t);
+      e.games++;
+      e.points += winner == before.active_player ? 2 : winner == EMPTY ? 1 : 0;
+    });
+  }
+
+  std::vector<BookEntry> entries;
+  for (auto &kv : merged) entries.push_back(kv.second);
+  return entries;
+}
+
+// entries must be sorted by (key, move), as build_book returns them.
+bool write_book(const char *path, const std::vector<BookEntry> &entries) {
+  FILE *f = fopen(path, "wb");
+  if (!f) return false;
+
+  BookHeader header;
+  std::memcpy(header.magic, BOOK_MAGIC, 4);
+  header.version = BOOK_VERSION;
+  header.count = entries.size();
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+         && fwrite(entries.data(), sizeof(BookEntry), entries.size(), f) == entries.size();
+  return fclose(f) == 0 && ok;
+}
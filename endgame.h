@@ -0,0 +1,388 @@
+#pragma once
+
+#include <memory>
+#include <cstring>
+#include <cstdint>
+
+#include "util.h"
+#include "board.h"
+
+// Below these numbers of empty squares the engines stop estimating:
+// uct_move, UctPlayer and minimax_move solve the root exactly, and UCT
+// replaces the rollout from a leaf with the game's solved outcome.
+struct EndgameSettings {
+  int root_empties;
+  int playout_empties;
+};
+
+EndgameSettings endgame_settings = { 14, 6 };
+
+// At or below this many empties nodes are ordered by parity alone; from
+// ENDGAME_TABLE_EMPTIES up they are also kept in the table.
+const int ENDGAME_SHALLOW = 6;
+const int ENDGAME_TABLE_EMPTIES = 7;
+
+// Quadrants of the board with an odd number of empties. A move in one
+// tends to let the mover also have the last move there.
+template<int N>
+inline board_bits<N> odd_quadrants(const board_bits<N> empty) {
+  board_bits<N> odd = 0;
+  for (int q = 0; q < 4; ++q) {
+    if (popcount(empty & GEOMETRY<N>.quadrants[q]) & 1) odd |= GEOMETRY<N>.quadrants[q];
+  }
+  return odd;
+}
+
+// Squares next to any disc of b.
+template<int N>
+inline board_bits<N> neighbours(const board_bits<N> b) {
+  const board_bits<N> h = (b | ((b << 1) & ~GEOMETRY<N>.columns[0]) | ((b >> 1) & ~GEOMETRY<N>.columns[N - 1]))
+                        & GEOMETRY<N>.all;
+  return (h | (h << N) | (h >> N)) & GEOMETRY<N>.all;
+}
+
+// Squares on lines with no empty square, in all four directions.
+template<int N>
+inline board_bits<N> full_lines(const board_bits<N> occupied) {
+  typedef board_bits<N> Bits;
+  const BoardGeometry<N> &g = GEOMETRY<N>;
+
+  Bits rows = 0, columns = 0;
+  for (int i = 0; i < N; ++i) {
+    if ((occupied & g.rows[i]) == g.rows[i]) rows |= g.rows[i];
+    if ((occupied & g.columns[i]) == g.columns[i]) columns |= g.columns[i];
+  }
+
+  Bits down = 0, up = 0;
+  for (int i = 0; i < 2 * (2 * N - 1); i += 2) {
+    if ((occupied & g.diagonals[i]) == g.diagonals[i]) down |= g.diagonals[i];
+    if ((occupied & g.diagonals[i + 1]) == g.diagonals[i + 1]) up |= g.diagonals[i + 1];
+  }
+  const Bits diagonals = down & up;
+
+  // an edge disc can only be flipped along its edge
+  const Bits edges = ((g.rows[0] | g.rows[N - 1]) & rows) | ((g.columns[0] | g.columns[N - 1]) & columns);
+
+  return (rows & columns & diagonals) | edges;
+}
+
+// Discs of o that can never be flipped: those on full lines, and runs
+// along an edge starting from a corner.
+template<int N>
+inline board_bits<N> stable_discs(const board_bits<N> o, const board_bits<N> occupied) {
+  board_bits<N> stable = o & full_lines<N>(occupied);
+
+  static const int corners[4] = { 0, N - 1, N * (N - 1), N * N - 1 };
+  static const int steps[4][2] = { {1, N}, {-1, N}, {1, -N}, {-1, -N} };
+
+  for (int c = 0; c < 4; ++c) {
+    for (int d = 0; d < 2; ++d) {
+      for (int sq = corners[c], i = 0; i < N && (o & square_bit<board_bits<N>>(sq)); ++i, sq += steps[c][d]) {
+        stable |= square_bit<board_bits<N>>(sq);
+      }
+    }
+  }
+
+  return stable;
+}
+
+template<typename Bits>
+inline int final_score(const Bits p, const Bits o) {
+  return popcount(p) - popcount(o);
+}
+
+inline uint64_t fold_bits(const uint64_t b) {
+  return b;
+}
+
+inline uint64_t fold_bits(const uint128 b) {
+  return uint64_t(b) ^ uint64_t(b >> 64) * 0xFF51AFD7ED558CCDULL;
+}
+
+template<typename Bits>
+struct EndgameEntry {
+  Bits p;
+  Bits o;
+  int8_t lower;
+  int8_t upper;
+  uint8_t move;
+  uint8_t generation;
+};
+
+// Alpha-beta solver on a pair of bitboards of an N x N board, with
+// null-window (PVS) searches on the disc difference, fastest-first move
+// ordering (fewest replies for the opponent) and a bounds table. It
+// allocates only the table, once; table_bits = 0 solves without one.
+// Scores are final disc differences for the side to move, as counted by
+// Board::winner (empty squares go to nobody).
+template<int N>
+struct Solver {
+  typedef board_bits<N> Bits;
+  typedef EndgameEntry<Bits> Entry;
+
+  static const int SQUARES = N * N;
+  static const int INF = N * N + 1;
+
+  std::unique_ptr<Entry[]> table;
+  uint64_t table_mask;
+  uint8_t generation;
+  uint64_t nodes;
+
+  Solver(int table_bits = 16)
+      : table(table_bits ? new Entry[1ULL << table_bits]() : NULL),
+        table_mask(table_bits ? (1ULL << table_bits) - 1 : 0),
+        generation(1), nodes(0) {}
+
+  // Forget all entries in O(1), wiping the table when the counter wraps.
+  void clear() {
+    if (++generation == 0 && table) {
+      std::memset(table.get(), 0, (table_mask + 1) * sizeof(Entry));
+      generation = 1;
+    }
+  }
+
+  Entry * slot(const Bits p, const Bits o) {
+    uint64_t key = fold_bits(p) * 0x9E3779B97F4A7C15ULL ^ fold_bits(o) * 0xC2B2AE3D27D4EB4FULL;
+    key ^= key >> 29;
+    return &table[key & table_mask];
+  }
+
+  // The one empty square is sq.
+  static int solve_last(const Bits p, const Bits o, const int sq) {
+    const int diff = final_score(p, o);
+    const Bits m = square_bit<Bits>(sq);
+
+    int flips = popcount(flip_mask<N>(m, p, o));
+    if (flips) return diff + 2 * flips + 1;
+
+    flips = popcount(flip_mask<N>(m, o, p));
+    if (flips) return diff - 2 * flips - 1;
+
+    return diff;
+  }
+
+  int solve_shallow(const Bits p, const Bits o, int alpha, const int beta, const bool passed) {
+    nodes++;
+
+    const Bits empty = ~(p | o) & GEOMETRY<N>.all;
+    if (popcount(empty) == 1) return solve_last(p, o, lowest_square(empty));
+
+    const Bits moves = move_mask<N>(p, o);
+    if (!moves) {
+      if (passed) return final_score(p, o);
+      return -solve_shallow(o, p, -beta, -alpha, true);
+    }
+
+    const Bits odd = odd_quadrants<N>(empty);
+    const Bits ordered[2] = { moves & odd, moves & ~odd };
+    int best = -INF;
+
+    for (Bits group : ordered) {
+      for (; group; group &= group - 1) {
+        const Bits m = group & -group;
+        const Bits flips = flip_mask<N>(m, p, o);
+
+        const int score = -solve_shallow(o & ~flips, p | flips | m, -beta, -alpha, false);
+        if (score > best) {
+          best = score;
+          if (score > alpha) alpha = score;
+          if (alpha >= beta) return best;
+        }
+      }
+    }
+
+    return best;
+  }
+
+  // Legal moves of p ordered for search: hash move first, then by the
+  // opponent's mobility afterwards, odd quadrants breaking ties.
+  static int order_moves(const Bits p, const Bits o, const uint8_t hash_move, uint8_t *moves) {
+    const Bits odd = odd_quadrants<N>(~(p | o) & GEOMETRY<N>.all);
+    const Bits corners = GEOMETRY<N>.corners;
+    int keys[SQUARES];
+    int n = 0;
+
+    for (Bits mask = move_mask<N>(p, o); mask; mask &= mask - 1) {
+      const int sq = lowest_square(mask);
+      const Bits m = square_bit<Bits>(sq);
+      const Bits flips = flip_mask<N>(m, p, o);
+
+      const Bits replies = move_mask<N>(o & ~flips, p | flips | m);
+      int key = sq == hash_move ? -INF
+              : 16 * (popcount(replies) + popcount(replies & corners))
+              + 2 * popcount(neighbours<N>(p | flips | m) & ~(p | o | m))
+              - 4 * ((odd & m) != 0) - 6 * ((m & corners) != 0);
+
+      int i = n++;
+      for (; i > 0 && keys[i - 1] > key; --i) {
+        keys[i] = keys[i - 1];
+        moves[i] = moves[i - 1];
+      }
+      keys[i] = key;
+      moves[i] = sq;
+    }
+
+    return n;
+  }
+
+  // Exact score if it lies inside (alpha, beta), otherwise a bound on it.
+  int solve(const Bits p, const Bits o, int alpha, int beta, const bool passed = false) {
+    const int empties = popcount(~(p | o) & GEOMETRY<N>.all);
+    if (empties <= ENDGAME_SHALLOW) return solve_shallow(p, o, alpha, beta, passed);
+
+    nodes++;
+
+    uint8_t moves[SQUARES];
+    Entry *entry = NULL;
+    uint8_t hash_move = NO_MOVE;
+
+    if (table && empties >= ENDGAME_TABLE_EMPTIES) {
+      entry = slot(p, o);
+      if (entry->generation == generation && entry->p == p && entry->o == o) {
+        if (entry->lower >= beta) return entry->lower;
+        if (entry->upper <= alpha) return entry->upper;
+        if (entry->lower == entry->upper) return entry->lower;
+        alpha = std::max<int>(alpha, entry->lower);
+        beta = std::min<int>(beta, entry->upper);
+        hash_move = entry->move;
+      }
+    }
+
+    // the opponent keeps its stable discs whatever happens
+    if (alpha >= SQUARES - 2 * popcount(o)) {
+      const int upper = SQUARES - 2 * popcount(stable_discs<N>(o, p | o));
+      if (upper <= alpha) return upper;
+      if (upper < beta) beta = upper;
+    }
+
+    const int n_moves = order_moves(p, o, hash_move, moves);
+
+    if (n_moves == 0) {
+      if (passed) return final_score(p, o);
+      return -solve(o, p, -beta, -alpha, true);
+    }
+
+    const int alpha_start = alpha;
+    int best = -INF;
+    uint8_t best_move = moves[0];
+
+    for (int i = 0; i < n_moves; ++i) {
+      const Bits m = square_bit<Bits>(moves[i]);
+      const Bits flips = flip_mask<N>(m, p, o);
+      const Bits next_p = o & ~flips;
+      const Bits next_o = p | flips | m;
+
+      int score;
+      if (i == 0) {
+        score = -solve(next_p, next_o, -beta, -alpha);
+      } else {
+        score = -solve(next_p, next_o, -alpha - 1, -alpha);
+        if (score > alpha && score < beta) {
+          score = -solve(next_p, next_o, -beta, -score);
+        }
+      }
+
+      if (score > best) {
+        best = score;
+        best_move = moves[i];
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) break;
+      }
+    }
+
+    if (entry) {
+      entry->p = p;
+      entry->o = o;
+      entry->lower = best > alpha_start ? best : -INF;
+      entry->upper = best < beta ? best : INF;
+      entry->move = best_move;
+      entry->generation = generation;
+    }
+
+    return best;
+  }
+
+  // Best square for the side to move, which must have a legal move. With
+  // exact set it maximizes the disc difference and *score is exact;
+  // otherwise it only separates wins, draws and losses (much faster) and
+  // *score is just positive, zero or negative.
+  int best_move(const Board<N> &state, const bool exact, int *score = NULL) {
+    clear();
+
+    const Bits p = state.pieces(state.active_player);
+    const Bits o = state.pieces(OTHER(state.active_player));
+
+    uint8_t moves[SQUARES];
+    const int n_moves = order_moves(p, o, NO_MOVE, moves);
+    assert(n_moves > 0);
+
+    int alpha = exact ? -INF : -1;
+    const int beta = exact ? INF : 1;
+    int best_score = -INF;
+    uint8_t best = moves[0];
+
+    for (int i = 0; i < n_moves && alpha < beta; ++i) {
+      const Bits m = square_bit<Bits>(moves[i]);
+      const Bits flips = flip_mask<N>(m, p, o);
+      const Bits next_p = o & ~flips;
+      const Bits next_o = p | flips | m;
+
+      int value;
+      if (i == 0) {
+        value = -solve(next_p, next_o, -beta, -alpha);
+      } else {
+        value = -solve(next_p, next_o, -alpha - 1, -alpha);
+        if (value > alpha && value < beta) {
+          value = -solve(next_p, next_o, -beta, -value);
+        }
+      }
+
+      if (value > best_score) {
+        best_score = value;
+        best = moves[i];
+        if (value > alpha) alpha = value;
+      }
+    }
+
+    if (score) *score = best_score;
+    return best;
+  }
+
+  // Winner of the game from state with perfect play, by a win/loss/draw
+  // null window around zero.
+  int winner(const Board<N> &state) {
+    const Bits p = state.pieces(state.active_player);
+    const Bits o = state.pieces(OTHER(state.active_player));
+
+    const int score = solve(p, o, -1, 1, state.passed);
+
+    if (score > 0) return state.active_player;
+    if (score < 0) return OTHER(state.active_player);
+    return EMPTY;
+  }
+};
+
+// The solver of the engines' board.
+typedef Solver<8> EndgameSolver;
+
+const int ENDGAME_INF = EndgameSolver::INF;
+
+// Solved move at the root once few enough squares are empty, or NO_MOVE
+// when the engine should search as usual (also when it has to pass). The
+// solver, and its table, belong to the calling thread.
+inline uint8_t endgame_move(const BoardState &state) {
+  if (popcount(state.empty()) > endgame_settings.root_empties || !state.move_mask()) return NO_MOVE;
+
+  static thread_local EndgameSolver solver;
+  return solver.best_move(state, false);
+}
+
+// Solved outcome standing in for a random playout near the end of the
+// game; each thread keeps a solver without a table.
+inline bool endgame_playout(const BoardState &state, int *winner) {
+  if (popcount(state.empty()) > endgame_settings.playout_empties) return false;
+
+  static thread_local EndgameSolver solver(0);
+  *winner = solver.winner(state);
+  return true;
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <chrono>
+
+#include "util.h"
+#include "board.h"
+#include "rng.h"
+#include "minimax.h"
+#include "uct.h"
+#include "endgame.h"
+#include "book.h"
+#include "pattern.h"
+
+// Long-lived engine driven by text commands, one per line, each answered
+// with one line. The UCT tree, the minimax table, the endgame solver's
+// table, the book and the pattern weights all outlive single searches.
+//
+//   newgame                          opening position, fresh tree
+//   position start|<board> [moves ...]
+//                                    board is 64 of x (black), o (white)
+//                                    and . from a1 to h8 rank by rank,
+//                                    followed by x or o for the mover
+//   play <move> ...                  moves like d3, or pass
+//   go uct|minimax [playouts n] [depth n] [time seconds]
+//                                    best move, without playing it
+//   threads <n>                      UCT search threads
+//   board                            the position, as for position
+//   stats                            what the engine holds
+//   quit
+//
+// Answers start with "ok", "bestmove", "board", "stats" or "error".
+
+// Budgets of a go without limits.
+const int ENGINE_UCT_PLAYOUTS = 100000;
+const int ENGINE_MINIMAX_DEPTH = 6;
+
+// Sizes the UCT arenas to about a million nodes (see UctPlayer::capacity).
+const int ENGINE_UCT_TRIALS = 1 << 10;
+
+inline std::string square_name(const uint8_t sq) {
+  if (sq == NO_MOVE || sq == PASS_SQUARE) return "pass";
+  return std::string(1, char('a' + SQUARE_X(sq))) + char('1' + SQUARE_Y(sq));
+}
+
+// The square named, PASS_SQUARE for "pass", or NO_MOVE.
+inline uint8_t parse_square(const std::string &name) {
+  if (name == "pass") return PASS_SQUARE;
+  if (name.size() != 2) return NO_MOVE;
+  const int x = name[0] - 'a', y = name[1] - '1';
+  return on_board(y, x) ? SQUARE(y, x) : NO_MOVE;
+}
+
+struct Engine {
+  BoardState state;
+  Rng rng;
+  int n_threads;
+
+  // created on the first UCT search, as it holds large arenas
+  std::unique_ptr<UctPlayer> uct;
+  MinimaxSearch<PatternEval> minimax;
+
+  uint64_t searches;
+
+  Engine(uint64_t seed, int n_threads = 1)
+      : rng(seed), n_threads(n_threads), minimax(PatternEval(), 20), searches(0) {}
+
+  // Answer to one command; sets quit on "quit".
+  std::string execute(const std::string &line, bool *quit) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+
+    if (command.empty()) return "error empty command";
+    if (command == "quit") {
+      *quit = true;
+      return "ok";
+    }
+    if (command == "newgame") {
+      state = BoardState();
+      if (uct) uct->tree.reset(state);
+      return "ok";
+    }
+    if (command == "position") return position(in);
+    if (command == "play") return play(in);
+    if (command == "go") return go(in);
+    if (command == "threads") {
+      int n;
+      if (!(in >> n) || n < 1) return "error threads needs a positive count";
+      n_threads = n;
+      if (uct) uct->n_threads = n;
+      return "ok";
+    }
+    if (command == "board") return "board " + board_string();
+    if (command == "stats") return stats();
+
+    return "error unknown command " + command;
+  }
+
+  std::string board_string() const {
+    std::string s;
+    for (int sq = 0; sq < 64; ++sq) {
+      s += (state.black & square_bit(sq)) ? 'x' : (state.white & square_bit(sq)) ? 'o' : '.';
+    }
+    return s + (state.active_player == BLACK ? " x" : " o");
+  }
+
+  std::string position(std::istringstream &in) {
+    std::string board;
+    in >> board;
+
+    BoardState next;
+    if (board != "start") {
+      std::string mover;
+      in >> mover;
+      if (board.size() != 64 || (mover != "x" && mover != "o")) return "error bad position";
+
+      next.black = next.white = 0;
+      for (int sq = 0; sq < 64; ++sq) {
+        if (board[sq] == 'x') next.black |= square_bit(sq);
+        else if (board[sq] == 'o') next.white |= square_bit(sq);
+        else if (board[sq] != '.') return "error bad position";
+      }
+      next.active_player = mover == "x" ? BLACK : WHITE;
+      next.hash = next.compute_hash();
+    }
+
+    std::string word;
+    if (in >> word && word != "moves") return "error expected moves";
+
+    state = next;
+    return play(in);
+  }
+
+  // Play the moves read from in, stopping at the first illegal one.
+  std::string play(std::istringstream &in) {
+    std::string name;
+    while (in >> name) {
+      const uint8_t sq = parse_square(name);
+      const uint64_t moves = state.move_mask();
+
+      if (sq == PASS_SQUARE && !moves) state.apply_pass();
+      else if (sq != NO_MOVE && sq != PASS_SQUARE && (moves & square_bit(sq))) state.apply_square(sq);
+      else return "error illegal move " + name;
+
+      // keep the tree's root on the game, so its statistics carry over
+      if (uct) uct->sync(state);
+    }
+    return "ok";
+  }
+
+  std::string go(std::istringstream &in) {
+    std::string algorithm, key;
+    in >> algorithm;
+    if (algorithm != "uct" && algorithm != "minimax") return "error go needs uct or minimax";
+
+    int playouts = 0, depth = 0;
+    double seconds = 0;
+    while (in >> key) {
+      if (key == "playouts" && in >> playouts && playouts > 0) continue;
+      if (key == "depth" && in >> depth && depth > 0) continue;
+      if (key == "time" && in >> seconds && seconds > 0) continue;
+      return "error bad search limit " + key;
+    }
+
+    const uint64_t moves = state.move_mask();
+    if (!moves) {
+      BoardState after(state);
+      after.apply_pass();
+      return after.move_mask() ? "bestmove pass source rules" : "bestmove none source rules";
+    }
+
+    searches++;
+    auto start = std::chrono::steady_clock::now();
+    const Deadline deadline(TimeControl(seconds), popcount(state.empty()));
+    std::ostringstream info;
+    uint8_t move;
+
+    if ((move = book_move(state)) != NO_MOVE) {
+      info << " source book";
+    } else if ((move = endgame_move(state)) != NO_MOVE) {
+      info << " source endgame";
+    } else if (algorithm == "uct") {
+      if (!playouts) playouts = seconds ? 1 << 30 : ENGINE_UCT_PLAYOUTS;
+      if (!uct) uct.reset(new UctPlayer(ENGINE_UCT_TRIALS, n_threads));
+
+      const int kept = uct->sync(state);
+      uct->tree.search(playouts, n_threads, rng, deadline);
+      const Point best = uct->tree.select_best_move();
+      move = SQUARE(best.first, best.second);
+
+      info << " source uct playouts " << uct->tree.root().visits - kept << " kept " << kept
+           << " nodes " << uct->tree.nodes.size;
+    } else {
+      if (!depth) depth = seconds ? 60 : ENGINE_MINIMAX_DEPTH;
+
+      move = minimax.search(&state, depth, rng, deadline);
+
+      info << " source minimax depth " << minimax.depth_reached << " nodes " << minimax.nodes;
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    info << " seconds " << elapsed;
+
+    return "bestmove " + square_name(move) + info.str();
+  }
+
+  std::string stats() const {
+    std::ostringstream out;
+    out << "stats empty " << popcount(state.empty())
+        << " searches " << searches
+        << " uct_nodes " << (uct ? uct->tree.nodes.size.load() : 0)
+        << " uct_root_visits " << (uct ? uct->tree.root().visits.load() : 0)
+        << " uct_bytes " << (uct ? uct->tree.memory_used() : 0)
+        << " minimax_nodes " << minimax.nodes
+        << " book_moves " << opening_book.count
+        << " pattern_weights " << (pattern_weights.loaded() ? 1 : 0);
+    return out.str();
+  }
+};
+
+// Serve commands from in until "quit" or the end of input.
+void run_engine(Engine &engine, std::istream &in, std::ostream &out) {
+  std::string line;
+  bool quit = false;
+  while (!quit && std::getline(in, line)) {
+    out << engine.execute(line, &quit) << std::endl;
+  }
+}
@@ -4,6 +4,9 @@
 #include <functional>
 #include <cmath>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
 
 #include "board.h"
 #include "util.h"
@@ -11,76 +14,364 @@
 #include "basic.h"
 #include "uct.h"
 #include "ucb.h"
+#include "tournament.h"
+#include "book.h"
+#include "pattern.h"
+#include "records.h"
+#include "engine.h"
 
 using namespace std;
 using namespace std::placeholders;
 
-// board evaluation functions
-eval_func eval_sampling_10 = bind(eval_sampling, _1, _2, 10);
-eval_func eval_sampling_100 = bind(eval_sampling, _1, _2, 100);
-eval_func eval_sampling_1000 = bind(eval_sampling, _1, _2, 1000);
-// eval_pieces
-// eval_inv_pieces
-
-move_func strategies[] = {
-  io_move, // player
-  random_move, // random
-  bind(greedy_move, _1, eval_pieces), // greedy 
-  bind(greedy_move, _1, eval_inv_pieces), // generous
-  bind(greedy_move, _1, eval_sampling_10), // greedy with random sampling 
-  bind(greedy_move, _1, eval_sampling_100),  
-  bind(greedy_move, _1, eval_sampling_1000),
-  bind(uct_move, _1, 10), // UCT with various amounts of sampling 
-  bind(uct_move, _1, 100),
-  bind(uct_move, _1, 1000),
-  bind(ucb1_move, _1, 10), // UCB1 with various amounts of sampling 
-  bind(ucb1_move, _1, 100),
-  bind(ucb1_move, _1, 1000),
-  bind(minimax_move, _1, eval_sampling_10, 3), // Minimax by sampling
-  bind(minimax_move, _1, eval_pieces, 3), // Minimax by piece count
-  bind(minimax_move, _1, eval_pieces, 4), // Minimax by piece count
-  bind(minimax_move, _1, eval_pieces, 5) // Minimax by piece count
+// Board evaluations are types (PiecesEval, InvPiecesEval, SamplingEval,
+// PatternEval), and each strategy below instantiates its engine for one,
+// so the type-erased move_func is the only indirect call per move.
+
+// Threads for the rollouts of one game: all cores for a single match, one
+// in a tournament, where the games themselves run in parallel.
+int rollout_threads = 1;
+
+// Factory for a strategy whose rollouts run on a pool of rollout_threads,
+// created with each game.
+function<move_func(RootVisits*)> with_pool(function<move_func(ThreadPool*)> f) {
+  return [f](RootVisits *) -> move_func {
+    auto pool = make_shared<ThreadPool>(rollout_threads);
+    move_func move = f(pool.get());
+    return [pool, move](BoardState *state, const TimeControl &tc, Rng &rng) { return move(state, tc, rng); };
+  };
+}
+
+// Seconds per move for the strategies limited only by the time control,
+// when the game has none; their playout and depth budgets are not meant
+// to be reached.
+const double FALLBACK_MOVE_SECONDS = 1.0;
+
+// Factory for a strategy that is given FALLBACK_MOVE_SECONDS a move when
+// the game has no time control.
+function<move_func(RootVisits*)> time_limited(function<move_func(RootVisits*)> f) {
+  return [f](RootVisits *visits) -> move_func {
+    move_func move = f(visits);
+    return [move](BoardState *state, const TimeControl &tc, Rng &rng) {
+      return move(state, tc.limited() ? tc : TimeControl(FALLBACK_MOVE_SECONDS), rng);
+    };
+  };
+}
+
+// Factory for a single-threaded uct_move strategy, which reports its root
+// visits when asked to.
+function<move_func(RootVisits*)> uct_strategy(int n_trials, const PatternWeights *prior, bool rave, Playout policy) {
+  return [=](RootVisits *visits) -> move_func {
+    return bind(uct_move, _1, n_trials, 1, _3, _2, prior, rave, policy, visits);
+  };
+}
+
+// Every strategy is called with the position and the mover's time
+// control (see TimeControl); search engines stop early to meet it.
+// Indices are the strategy ids taken on the command line.
+vector<Strategy> strategies = {
+  {"Human", stateless(bind(io_move, _1))},
+  {"Random", stateless(bind(random_move, _1, _3))},
+  {"Greedy", stateless(bind(greedy_move<PiecesEval>, _1, PiecesEval(), _3))},
+  {"Generous", stateless(bind(greedy_move<InvPiecesEval>, _1, InvPiecesEval(), _3))},
+  {"Uniform sampling (10)", stateless(bind(greedy_move<SamplingEval>, _1, SamplingEval(10, nullptr), _3))},
+  {"Uniform sampling (100)", stateless(bind(greedy_move<SamplingEval>, _1, SamplingEval(100, nullptr), _3))},
+  {"Uniform sampling (1000)", with_pool([](ThreadPool *pool) -> move_func {
+    return bind(greedy_move<SamplingEval>, _1, SamplingEval(1000, pool), _3);
+  })},
+  {"UCT (10)", uct_strategy(10, nullptr, false, PLAYOUT_UNIFORM)}, // UCT on one thread
+  {"UCT (100)", uct_strategy(100, nullptr, false, PLAYOUT_UNIFORM)},
+  {"UCT (1000)", uct_strategy(1000, nullptr, false, PLAYOUT_UNIFORM)},
+  {"UCB1 (10)", stateless(bind(ucb1_move, _1, 10, _3, _2, nullptr, PLAYOUT_UNIFORM))},
+  {"UCB1 (100)", stateless(bind(ucb1_move, _1, 100, _3, _2, nullptr, PLAYOUT_UNIFORM))},
+  {"UCB1 (1000)", with_pool([](ThreadPool *pool) -> move_func { // batched over the pool
+    return bind(ucb1_move, _1, 1000, _3, _2, pool, PLAYOUT_UNIFORM);
+  })},
+  {"MiniMax sampling (10)", stateless(bind(minimax_move<SamplingEval>, _1, SamplingEval(10, nullptr), 3, _3, _2))},
+  {"MiniMax (3)", stateless(bind(minimax_move<PiecesEval>, _1, PiecesEval(), 3, _3, _2))},
+  {"MiniMax (4)", stateless(bind(minimax_move<PiecesEval>, _1, PiecesEval(), 4, _3, _2))},
+  {"MiniMax (5)", stateless(bind(minimax_move<PiecesEval>, _1, PiecesEval(), 5, _3, _2))},
+  {"UCT reuse (10)", [](RootVisits *visits) { return uct_player(10, 1, false, visits); }}, // a fresh tree each game
+  {"UCT reuse (100)", [](RootVisits *visits) { return uct_player(100, 1, false, visits); }},
+  {"UCT reuse (1000)", [](RootVisits *visits) { return uct_player(1000, 1, false, visits); }},
+  {"UCT reuse (time)", time_limited([](RootVisits *visits) { return uct_player(1 << 20, 1, false, visits); })}, // limited only by the time control
+  {"MiniMax (time)", time_limited(stateless(bind(minimax_move<PiecesEval>, _1, PiecesEval(), 60, _3, _2)))},
+  {"MiniMax patterns (4)", stateless(bind(minimax_move<PatternEval>, _1, PatternEval(), 4, _3, _2))},
+  {"UCT patterns (1000)", uct_strategy(1000, &pattern_weights, false, PLAYOUT_UNIFORM)},
+  {"UCT ponder (time)", time_limited([](RootVisits *visits) { return uct_player(1 << 20, 1, true, visits); })}, // searches on the opponent's time
+  {"UCT RAVE (100)", uct_strategy(100, nullptr, true, PLAYOUT_UNIFORM)},
+  {"UCT RAVE (1000)", uct_strategy(1000, nullptr, true, PLAYOUT_UNIFORM)},
+  {"UCT corners (100)", uct_strategy(100, nullptr, false, PLAYOUT_CORNERS)},
+  {"UCT weighted (100)", uct_strategy(100, nullptr, false, PLAYOUT_WEIGHTED)},
+  {"UCB1 corners (100)", stateless(bind(ucb1_move, _1, 100, _3, _2, nullptr, PLAYOUT_CORNERS))}
 };
 
+// Game i of a match (or of a tournament) draws from stream i of this seed.
+const uint64_t SEED = 10101010;
+
+// Appended to by "reversi selfplay", read by "reversi book" and "reversi train".
+const char *GAMES_PATH = "games.rec";
+
+// Written by "reversi book" and read at startup.
+const char *BOOK_PATH = "opening.book";
+
+// Written by "reversi train" and read at startup.
+const char *WEIGHTS_PATH = "pattern.weights";
+
+// The contestants of tournament.py.
+const vector<int> default_contestants = {1, 2, 3, 4, 5, 10, 11, 7, 8, 14, 15, 16};
+
+// reversi tournament [rounds] [threads] [move_seconds] [clock_seconds] [ids...]
+int tournament(int argc, char ** argv) {
+  int rounds = 100;
+  int n_threads = thread::hardware_concurrency();
+  double move_seconds = 0;
+  double clock_seconds = 0;
+  vector<int> ids;
+
+  if (argc > 2) rounds = stoi(argv[2]);
+  if (argc > 3) n_threads = stoi(argv[3]);
+  if (argc > 4) move_seconds = stod(argv[4]);
+  if (argc > 5) clock_seconds = stod(argv[5]);
+  for (int i = 6; i < argc; ++i) ids.push_back(stoi(argv[i]));
+  if (ids.empty()) ids = default_contestants;
+
+  vector<Strategy> contestants;
+  for (int id : ids) contestants.push_back(strategies.at(id));
+
+  cout << "Playing " << ids.size() * ids.size() * rounds << " games on "
+       << max(n_threads, 1) << " threads" << endl;
+
+  auto start = chrono::steady_clock::now();
+  TournamentResult result = run_tournament(contestants, rounds, max(n_threads, 1), SEED,
+                                           move_seconds, clock_seconds);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  mkdir("tournament_data", 0755);
+  write_tournament(result, "tournament_data");
+
+  vector<int> order(ids.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  sort(order.begin(), order.end(), [&](int a, int b) { return result.elo[a] > result.elo[b]; });
+
+  for (int i : order) {
+    printf("%6.0f +- %3.0f  %s\n", result.elo[i], result.elo_error[i], result.names[i].c_str());
+  }
+  printf("%.1f s\n", seconds);
+
+  return 0;
+}
+
+// reversi selfplay [games] [black] [white] [threads] [visits] [seed]
+int selfplay(int argc, char ** argv) {
+  int n_games = 1000;
+  int black = 8;
+  int white = 8;
+  int n_threads = max<int>(thread::hardware_concurrency(), 1);
+  bool visits = false;
+  uint64_t seed = SEED;
+
+  if (argc > 2) n_games = stoi(argv[2]);
+  if (argc > 3) black = stoi(argv[3]);
+  if (argc > 4) white = stoi(argv[4]);
+  if (argc > 5) n_threads = stoi(argv[5]);
+  if (argc > 6) visits = string(argv[6]) != "0";
+  if (argc > 7) seed = stoull(argv[7]);
+
+  GameWriter writer;
+  if (!writer.open(GAMES_PATH)) {
+    cerr << "Could not append to " << GAMES_PATH << endl;
+    return 1;
+  }
+
+  cout << "Playing " << n_games << " games of " << strategies.at(black).name << " against "
+       << strategies.at(white).name << " on " << n_threads << " threads" << endl;
+
+  auto start = chrono::steady_clock::now();
+  bool ok = self_play(strategies.at(black), strategies.at(white), n_games, n_threads, seed, writer, visits);
+  ok = writer.close() && ok;
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  if (!ok) {
+    cerr << "Could not write " << GAMES_PATH << endl;
+    return 1;
+  }
+
+  printf("%llu games appended to %s, %.1f games/s\n", (unsigned long long) writer.written, GAMES_PATH,
+         writer.written / seconds);
+  return 0;
+}
+
+// reversi book [plies]
+int book(int argc, char ** argv) {
+  int plies = 12;
+
+  if (argc > 2) plies = stoi(argv[2]);
+
+  GameReader reader;
+  if (!reader.open(GAMES_PATH)) {
+    cerr << "No games in " << GAMES_PATH << ", see reversi selfplay" << endl;
+    return 1;
+  }
+
+  vector<BookEntry> entries = build_book(reader, plies);
+  if (!write_book(BOOK_PATH, entries)) {
+    cerr << "Could not write " << BOOK_PATH << endl;
+    return 1;
+  }
+
+  cout << entries.size() << " book moves written to " << BOOK_PATH << endl;
+  return 0;
+}
+
+// reversi train [epochs]
+int train(int argc, char ** argv) {
+  int epochs = 20;
+
+  if (argc > 2) epochs = stoi(argv[2]);
+
+  GameReader reader;
+  if (!reader.open(GAMES_PATH)) {
+    cerr << "No games in " << GAMES_PATH << ", see reversi selfplay" << endl;
+    return 1;
+  }
+
+  vector<PatternSample> samples = record_samples(reader);
+
+  Rng rng(SEED);
+  vector<double> errors;
+  PatternWeights weights = train_patterns(samples, epochs, rng, &errors);
+
+  for (size_t i = 0; i < errors.size(); ++i) {
+    printf("epoch %2zu: rms error %.2f discs\n", i + 1, sqrt(errors[i]));
+  }
+
+  if (!weights.save(WEIGHTS_PATH)) {
+    cerr << "Could not write " << WEIGHTS_PATH << endl;
+    return 1;
+  }
+
+  cout << samples.size() << " positions fitted, weights written to " << WEIGHTS_PATH << endl;
+  return 0;
+}
+
+template<int N>
+void sized_study(int depth, int games, int empties) {
+  printf("%dx%d board\n", N, N);
+
+  for (int d = 1; d <= depth; ++d) {
+    auto start = chrono::steady_clock::now();
+    const uint64_t leaves = perft(Board<N>(), d);
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("perft %2d: %12llu  %.3fs\n", d, (unsigned long long) leaves, seconds);
+  }
+
+  Rng rng(SEED);
+  int wins[3] = { 0, 0, 0 };
+  auto start = chrono::steady_clock::now();
+  const Board<N> opening;
+  for (int i = 0; i < games; ++i) wins[random_playout(&opening, rng)]++;
+  const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("%d random games: black %d, white %d, drawn %d, %.0f games/s\n",
+         games, wins[BLACK], wins[WHITE], wins[EMPTY], games / seconds);
+
+  // solve random positions with empties squares left, where there are any
+  Solver<N> solver(20);
+  for (int i = 0; i < 5; ++i) {
+    Board<N> board;
+    while (popcount(board.empty()) > empties) {
+      const board_bits<N> moves = board.move_mask();
+      if (!moves) break;
+      board.apply_square(nth_square(moves, rng.bounded(popcount(moves))));
+    }
+
+    solver.clear();
+    solver.nodes = 0;
+    start = chrono::steady_clock::now();
+    const int score = solver.solve(board.pieces(board.active_player), board.pieces(OTHER(board.active_player)),
+                                   -Solver<N>::INF, Solver<N>::INF);
+    const double solve_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("solve %2d empties: %+3d for the mover, %llu nodes, %.3fs\n",
+           popcount(board.empty()), score, (unsigned long long) solver.nodes, solve_seconds);
+  }
+}
+
+// reversi size <6|8|10> [perft depth] [random games] [solve empties]
+int board_size(int argc, char ** argv) {
+  const int n = argc > 2 ? stoi(argv[2]) : 6;
+  const int depth = argc > 3 ? stoi(argv[3]) : 8;
+  const int games = argc > 4 ? stoi(argv[4]) : 100000;
+  const int empties = argc > 5 ? stoi(argv[5]) : 14;
+
+  switch (n) {
+    case 6: sized_study<6>(depth, games, empties); return 0;
+    case 8: sized_study<8>(depth, games, empties); return 0;
+    case 10: sized_study<10>(depth, games, empties); return 0;
+  }
+
+  cerr << "Boards are 6, 8 or 10 squares wide" << endl;
+  return 1;
+}
+
 int main(int argc, char ** argv) {
-  srand(10101010);
+  if (argc > 1 && string(argv[1]) == "selfplay") {
+    return selfplay(argc, argv);
+  }
+
+  if (argc > 1 && string(argv[1]) == "book") {
+    return book(argc, argv);
+  }
+
+  if (argc > 1 && string(argv[1]) == "train") {
+    return train(argc, argv);
+  }
+
+  if (argc > 1 && string(argv[1]) == "size") {
+    return board_size(argc, argv);
+  }
+
+  // played from by every engine that searches, if it has been built
+  opening_book.load(BOOK_PATH);
+
+  // used by the pattern strategies, if they have been trained
+  pattern_weights.load(WEIGHTS_PATH);
+
+  if (argc > 1 && string(argv[1]) == "tournament") {
+    return tournament(argc, argv);
+  }
+
+  // reversi engine [threads]: serve commands on stdin (see engine.h)
+  if (argc > 1 && string(argv[1]) == "engine") {
+    Engine engine(SEED, argc > 2 ? stoi(argv[2]) : 1);
+    run_engine(engine, cin, cout);
+    return 0;
+  }
+
+  rollout_threads = max<int>(thread::hardware_concurrency(), 1);
 
   int p1_strategy = 0;
   int p2_strategy = 1;
   int rounds = 1;
   bool print_states = false;
+  double move_seconds = 0;
+  double clock_seconds = 0;
 
   if (argc > 1) p1_strategy = stoi(argv[1]);
   if (argc > 2) p2_strategy = stoi(argv[2]);
   if (argc > 3) rounds = stoi(argv[3]);
   if (argc > 4) print_states = string(argv[4]) != "0";
+  if (argc > 5) move_seconds = stod(argv[5]);
+  if (argc > 6) clock_seconds = stod(argv[6]);
 
   int p1_wins = 0;
   int p2_wins = 0;
 
   for (int i = 0; i < rounds; ++i) {
-    BoardState state;
-
-    move_func player_1 = strategies[p1_strategy]; // black
-    move_func player_2 = strategies[p2_strategy];
-
-    bool passed = false;
-    while (true) {
-      if (print_states) {
-        state.print();
-      }
-      
-      bool pass = !player_1(&state);
-      if (pass && passed) {
-        break;
-      }
-      passed = pass;
-      
-      swap(player_1, player_2);
-    }
+    Rng rng = Rng::stream(SEED, i);
+    BoardState state = play_game(strategies[p1_strategy].make(NULL), strategies[p2_strategy].make(NULL),
+                                 move_seconds, clock_seconds, print_states, rng);
 
-    int w_score = eval_pieces(&state, WHITE);
-    int b_score = eval_pieces(&state, BLACK);
+    int w_score = state.count(WHITE);
+    int b_score = state.count(BLACK);
 
     if (w_score > b_score) p2_wins++;
     if (w_score < b_score) p1_wins++;
@@ -93,4 +384,4 @@ int main(int argc, char ** argv) {
     cout << "Player 1 wins: " << p1_wins << endl;
     cout << "Player 2 wins: " << p2_wins << endl;
   }
-}
\ No newline at end of file
+}
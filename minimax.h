@@ -1,107 +1,247 @@
 #pragma once
 
 #include <limits>
+#include <memory>
+#include <cstring>
 
 #include "util.h"
 #include "board.h"
+#include "rng.h"
+#include "endgame.h"
+#include "book.h"
+
+// Scores are from the point of view of the side to move (negamax). The
+// evaluation function scores for a fixed player, so leaves negate it
+// when the other side is to move.
+const int SCORE_INF = std::numeric_limits<int>::max() / 2;
+
+const int MAX_PLY = 128;
+
+enum Bound : uint8_t { BOUND_NONE, BOUND_EXACT, BOUND_LOWER, BOUND_UPPER };
+
+struct SearchEntry {
+  uint64_t key;
+  int32_t score;
+  int8_t depth;
+  Bound bound;
+  uint8_t move;
+};
+
+// Alpha-beta negamax with iterative deepening, principal variation
+// search, a transposition table and killer / history move ordering.
+// Eval is called as eval(state, player, rng) at every leaf; taking its
+// type as a parameter lets the compiler inline it there.
+template<typename Eval>
+struct MinimaxSearch {
+  Eval eval;
+  int player;
+  Rng *rng;
+
+  std::unique_ptr<SearchEntry[]> table;
+  uint64_t table_mask;
+
+  uint8_t killers[MAX_PLY][2];
+  int history[64];
+
+  uint8_t root_move;
+  uint64_t nodes;
+  int depth_reached;
+
+  Deadline deadline;
+  bool stopped;
+
+  MinimaxSearch(Eval eval = Eval(), int table_bits = 16)
+      : eval(eval), player(EMPTY), rng(NULL),
+        table(new SearchEntry[1ULL << table_bits]()),
+        table_mask((1ULL << table_bits) - 1) {
+    reset();
+  }
 
-int min_move(BoardState *state, int d, int player, int alpha, eval_func eval);
+  void reset() {
+    std::memset(killers, NO_MOVE, sizeof(killers));
+    std::memset(history, 0, sizeof(history));
+    nodes = 0;
+    depth_reached = 0;
+    stopped = false;
+  }
 
-int max_move(BoardState *state, int d, int player, int beta, eval_func eval) {
-  auto valid_moves = state->moves();
+  int evaluate(BoardState *state) {
+    const int score = eval(state, player, *rng);
+    return state->active_player == player ? score : -score;
+  }
 
-  if (d == 0) {
-    return eval(state, player);
+  SearchEntry * probe(const uint64_t key) {
+    SearchEntry *entry = &table[key & table_mask];
+    return entry->key == key && entry->bound != BOUND_NONE ? entry : NULL;
   }
 
-  if (valid_moves.size() == 0) {
-    BoardState next_state(*state);
-    next_state.apply(PASS);
-    return min_move(&next_state, d - 1, player, std::numeric_limits<int>::min(), eval);
+  void store(const uint64_t key, const int depth, const int score, const Bound bound, const uint8_t move) {
+    SearchEntry *entry = &table[key & table_mask];
+    if (entry->key != key && entry->bound != BOUND_NONE && entry->depth > depth) return;
+    entry->key = key;
+    entry->score = score;
+    entry->depth = depth;
+    entry->bound = bound;
+    entry->move = move;
   }
 
-  int best_score = 0;
-  Point best_move;
+  // Legal moves of state in search order: hash move, killers, history.
+  int order_moves(const BoardState &state, const int ply, const uint8_t hash_move, uint8_t *moves) {
+    int scores[64];
+    int n = 0;
+
+    for (uint64_t mask = state.move_mask(); mask; mask &= mask - 1) {
+      const int sq = lowest_square(mask);
+      int score = history[sq];
+      if (sq == hash_move) score = SCORE_INF;
+      else if (sq == killers[ply][0]) score = SCORE_INF - 1;
+      else if (sq == killers[ply][1]) score = SCORE_INF - 2;
+
+      int i = n++;
+      for (; i > 0 && scores[i - 1] < score; --i) {
+        scores[i] = scores[i - 1];
+        moves[i] = moves[i - 1];
+      }
+      scores[i] = score;
+      moves[i] = sq;
+    }
 
-  for (auto move : valid_moves) {
-    BoardState next_state(*state);
-    next_state.apply(move);
+    return n;
+  }
 
-    int score = min_move(&next_state, d - 1, player, best_score, eval);
-    if (score > beta) {
-      best_score = beta;
-      break;
+  void record_cutoff(const int ply, const int depth, const uint8_t move) {
+    if (killers[ply][0] != move) {
+      killers[ply][1] = killers[ply][0];
+      killers[ply][0] = move;
     }
+    history[move] += depth * depth;
+  }
 
-    if (score > best_score) {
-      best_move = move;
-      best_score = score;
+  // Once the deadline has passed, every call returns at once and the
+  // unfinished iteration is thrown away.
+  int negamax(BoardState *state, int depth, int alpha, int beta, int ply) {
+    nodes++;
+
+    if (nodes % (64 * DEADLINE_POLL) == 0 && depth_reached > 0 && deadline.expired()) {
+      stopped = true;
     }
-  }
+    if (stopped) return 0;
 
-  return best_score;
-}
+    if (depth == 0 || ply >= MAX_PLY - 1) {
+      return evaluate(state);
+    }
 
-int min_move(BoardState *state, int d, int player, int alpha, eval_func eval) {
-  auto valid_moves = state->moves();
+    const int alpha_start = alpha;
+    uint8_t hash_move = NO_MOVE;
 
-  if (d == 0) {
-    return eval(state, player);
-  }
+    if (SearchEntry *entry = probe(state->hash)) {
+      hash_move = entry->move;
+      if (entry->depth >= depth && ply > 0) {
+        if (entry->bound == BOUND_EXACT) return entry->score;
+        if (entry->bound == BOUND_LOWER && entry->score >= beta) return entry->score;
+        if (entry->bound == BOUND_UPPER && entry->score <= alpha) return entry->score;
+      }
+    }
 
-  if (valid_moves.size() == 0) {
-    BoardState next_state(*state);
-    next_state.apply(PASS);
-    return max_move(&next_state, d - 1, player, std::numeric_limits<int>::max(), eval);
-  }
+    uint8_t moves[64];
+    const int n_moves = order_moves(*state, ply, hash_move, moves);
+
+    if (n_moves == 0) {
+      if (state->passed) {
+        return evaluate(state);
+      }
+      const Undo undo = state->apply_pass();
+      const int score = -negamax(state, depth - 1, -beta, -alpha, ply + 1);
+      state->undo(undo);
+      return score;
+    }
 
-  int best_score = std::numeric_limits<int>::max();
-  Point best_move;
+    int best_score = -SCORE_INF;
+    uint8_t best_move = moves[0];
 
-  for (auto move : valid_moves) {
-    BoardState next_state(*state);
-    next_state.apply(move);
+    // children are searched in place, each move taken back after it
+    for (int i = 0; i < n_moves; ++i) {
+      const Undo undo = state->apply_square(moves[i]);
 
-    int score = max_move(&next_state, d - 1, player, best_score, eval);
-    if (score < alpha) {
-      best_score = alpha;
-      break;
-    }
+      int score;
+      if (i == 0) {
+        score = -negamax(state, depth - 1, -beta, -alpha, ply + 1);
+      } else {
+        // prove the move is no better than the principal variation
+        score = -negamax(state, depth - 1, -alpha - 1, -alpha, ply + 1);
+        if (score > alpha && score < beta) {
+          score = -negamax(state, depth - 1, -beta, -alpha, ply + 1);
+        }
+      }
 
-    if (score < best_score) {
-      best_move = move;
-      best_score = score;
+      state->undo(undo);
+
+      if (stopped) return 0;
+
+      if (score > best_score) {
+        best_score = score;
+        best_move = moves[i];
+      }
+
+      if (score > alpha) alpha = score;
+
+      if (alpha >= beta) {
+        record_cutoff(ply, depth, moves[i]);
+        break;
+      }
     }
+
+    const Bound bound = best_score <= alpha_start ? BOUND_UPPER
+                      : best_score >= beta ? BOUND_LOWER : BOUND_EXACT;
+    store(state->hash, depth, best_score, bound, best_move);
+    if (ply == 0) root_move = best_move;
+
+    return best_score;
   }
 
-  return best_score;
-}
+  // Best move for the side to move, searching 1, 2, ..., max_depth plies
+  // or until the deadline. Depth 1 always completes. Sampling evaluations
+  // draw from rng. Killers and history start afresh; the table is kept.
+  int search(BoardState *state, int max_depth, Rng &rng, const Deadline &until = Deadline()) {
+    reset();
+    player = state->active_player;
+    this->rng = &rng;
+    deadline = until;
+    uint8_t best_move = NO_MOVE;
+
+    for (int depth = 1; depth <= max_depth && !stopped; ++depth) {
+      negamax(state, depth, -SCORE_INF, SCORE_INF, 0);
+      if (stopped) break;
+
+      best_move = root_move;
+      depth_reached = depth;
+    }
 
-bool minimax_move(BoardState *state, eval_func eval, int max_depth) {
-  auto valid_moves = state->moves();
+    return best_move;
+  }
+};
+
+// Searches max_depth plies below each candidate move, as before, or as
+// deep as the time control allows. Book openings are played from the
+// book and endgames are solved instead (see endgame_settings).
+template<typename Eval>
+bool minimax_move(BoardState *state, Eval eval, int max_depth, Rng &rng, const TimeControl &tc = TimeControl()) {
+  const Deadline deadline(tc, popcount(state->empty()));
 
-  if (valid_moves.size() == 0) {
-    printf("pass\n");
+  if (!state->move_mask()) {
     state->apply(PASS);
     return false;
   }
 
-  int player = state->active_player;
-  int best_score = -1;
-  Point best_move;
-
-  for (auto move : valid_moves) {
-    BoardState next_state(*state);
-    next_state.apply(move);
-
-    int score = min_move(&next_state, max_depth, player, best_score, eval);
-    if (score > best_score) {
-      best_move = move;
-      best_score = score;
-    }
+  uint8_t known = book_move(*state);
+  if (known == NO_MOVE) known = endgame_move(*state);
+  if (known != NO_MOVE) {
+    state->apply_square(known);
+    return true;
   }
-  assert(best_score != -1);
-  state->apply(best_move);
+
+  MinimaxSearch<Eval> search(eval);
+  state->apply_square(search.search(state, max_depth + 1, rng, deadline));
 
   return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "util.h"
+#include "board.h"
+#include "rng.h"
+#include "records.h"
+
+// Pattern evaluation: the squares of each pattern index a table of
+// weights by their contents in base 3 (0 empty, 1 the mover's, 2 the
+// opponent's), and the position scores the sum of its weights, in
+// 1/PATTERN_UNIT discs of final disc difference for the side to move.
+// Every pattern is read from all eight symmetries of the board, so the
+// evaluation is symmetric and shares weights between orientations.
+
+const uint64_t PATTERN_MASKS[] = {
+  0x00000000000042FFULL,  // edge and both X squares
+  0x0000000000001F1FULL,  // 2x5 corner
+  0x0000000000070707ULL,  // 3x3 corner
+  0x000000000000FF00ULL,  // second rank
+  0x0000000000FF0000ULL,  // third rank
+  0x00000000FF000000ULL,  // fourth rank
+  0x8040201008040201ULL,  // main diagonal
+  0x0080402010080402ULL,  // diagonals of 7, 6, 5 and 4 squares
+  0x0000804020100804ULL,
+  0x0000008040201008ULL,
+  0x0000000080402010ULL,
+};
+
+const int N_PATTERNS = sizeof(PATTERN_MASKS) / sizeof(PATTERN_MASKS[0]);
+
+// Features of a position: every pattern in every orientation, plus a bias.
+const int N_PATTERN_FEATURES = 8 * N_PATTERNS + 1;
+
+// Separate weights for every PATTERN_PHASE_DISCS discs on the board.
+const int PATTERN_PHASES = 6;
+const int PATTERN_PHASE_DISCS = 10;
+
+const int PATTERN_UNIT = 64;
+
+inline int pattern_phase(const uint64_t p, const uint64_t o) {
+  return std::min((popcount(p | o) - 4) / PATTERN_PHASE_DISCS, PATTERN_PHASES - 1);
+}
+
+// The bits of b under mask, packed into the low bits in square order.
+inline uint32_t gather_bits(const uint64_t b, uint64_t mask) {
+#ifdef __BMI2__
+  return _pext_u64(b, mask);
+#else
+  uint32_t bits = 0;
+  for (int i = 0; mask; mask &= mask - 1, ++i) {
+    if (b & mask & -mask) bits |= 1u << i;
+  }
+  return bits;
+#endif
+}
+
+// Where each pattern's weights start within a phase, and the base 3
+// value of every up to 10-bit binary number.
+struct PatternIndex {
+  uint32_t offsets[N_PATTERNS];
+  uint32_t phase_size;
+  uint16_t ternary[1 << 10];
+
+  PatternIndex() {
+    uint32_t offset = 0;
+    for (int i = 0; i < N_PATTERNS; ++i) {
+      offsets[i] = offset;
+      offset += uint32_t(std::pow(3, popcount(PATTERN_MASKS[i])) + 0.5);
+    }
+    phase_size = offset + 1;  // the bias comes last
+
+    for (int b = 0; b < (1 << 10); ++b) {
+      int value = 0;
+      for (int i = 9; i >= 0; --i) value = 3 * value + ((b >> i) & 1);
+      ternary[b] = value;
+    }
+  }
+};
+
+const PatternIndex pattern_index;
+
+// Call f with the index, among all phases' weights, of every feature of
+// the position where p moves against o.
+template<typename F>
+inline void pattern_features(const uint64_t p, const uint64_t o, const F f) {
+  const uint32_t base = pattern_phase(p, o) * pattern_index.phase_size;
+
+  for (int t = 0; t < 8; ++t) {
+    const uint64_t tp = transform_bitboard(p, t);
+    const uint64_t to = transform_bitboard(o, t);
+    for (int i = 0; i < N_PATTERNS; ++i) {
+      f(base + pattern_index.offsets[i]
+          + pattern_index.ternary[gather_bits(tp, PATTERN_MASKS[i])]
+          + 2 * pattern_index.ternary[gather_bits(to, PATTERN_MASKS[i])]);
+    }
+  }
+
+  f(base + pattern_index.phase_size - 1);
+}
+
+// Weights file: a PatternHeader followed by header.count int16 weights,
+// PATTERN_PHASES tables of pattern_index.phase_size.
+
+const char PATTERN_MAGIC[4] = { 'R', 'P', 'A', 'T' };
+const uint32_t PATTERN_VERSION = 1;
+
+struct PatternHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+static_assert(sizeof(PatternHeader) == 16, "pattern headers are written as is");
+
+struct PatternWeights {
+  std::vector<int16_t> weights;
+
+  bool loaded() const {
+    return !weights.empty();
+  }
+
+  // Score for p, to move, against o; 0 without weights.
+  int score(const uint64_t p, const uint64_t o) const {
+    if (!loaded()) return 0;
+    int sum = 0;
+    const int16_t *w = weights.data();
+    pattern_features(p, o, [&sum, w](uint32_t f) { sum += w[f]; });
+    return sum;
+  }
+
+  int score(const BoardState &state) const {
+    return score(state.pieces(state.active_player), state.pieces(OTHER(state.active_player)));
+  }
+
+  // False if path is missing or does not hold weights for these patterns.
+  bool load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    PatternHeader header;
+    std::vector<int16_t> w(size_t(PATTERN_PHASES) * pattern_index.phase_size);
+    const bool ok = fread(&header, sizeof(header), 1, f) == 1
+                 && std::memcmp(header.magic, PATTERN_MAGIC, 4) == 0
+                 && header.version == PATTERN_VERSION && header.count == w.size()
+                 && fread(w.data(), sizeof(int16_t), w.size(), f) == w.size();
+    fclose(f);
+
+    if (ok) weights.swap(w);
+    return ok;
+  }
+
+  bool save(const char *path) const {
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+
+    PatternHeader header;
+    std::memcpy(header.magic, PATTERN_MAGIC, 4);
+    header.version = PATTERN_VERSION;
+    header.count = weights.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+           && fwrite(weights.data(), sizeof(int16_t), weights.size(), f) == weights.size();
+    return fclose(f) == 0 && ok;
+  }
+};
+
+// Weights used by eval_patterns, if loaded.
+PatternWeights pattern_weights;
+
+// Pattern score of state for player. Without weights, the piece count.
+int eval_patterns(BoardState *state, int player, Rng &) {
+  if (!pattern_weights.loaded()) return state->count(player);
+  const int score = pattern_weights.score(*state);
+  return state->active_player == player ? score : -score;
+}
+
+struct PatternEval {
+  int operator()(BoardState *state, int player, Rng &rng) const {
+    return eval_patterns(state, player, rng);
+  }
+};
+
+// A position of a recorded game and its final disc difference, both for
+// the side to move.
+struct PatternSample {
+  uint64_t p;
+  uint64_t o;
+  int score;
+};
+
+// Every position with a move to play from the games read from reader.
+std::vector<PatternSample> record_samples(GameReader &reader) {
+  std::vector<PatternSample> samples;
+
+  GameRecord record;
+  while (reader.next(record)) {
+    replay(record, [&](const BoardState &before, uint8_t move) {
+      if (move == RECORD_PASS) return;
+      const int score = before.active_player == BLACK ? record.score : -record.score;
+      samples.push_back({ before.pieces(before.active_player), before.pieces(OTHER(before.active_player)), score });
+    });
+  }
+
+  return samples;
+}
+
+// Least squares fit of the final disc differences of samples, by
+// stochastic gradient descent over epochs shuffled passes with a
+// learning rate falling linearly to zero. The mean squared error of
+// each epoch (before its updates) goes to errors if given.
+PatternWeights train_patterns(const std::vector<PatternSample> &samples, int epochs, Rng &rng,
+                              std::vector<double> *errors = NULL) {
+  std::vector<uint32_t> features(samples.size() * N_PATTERN_FEATURES);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    uint32_t *f = &features[i * N_PATTERN_FEATURES];
+    pattern_features(samples[i].p, samples[i].o, [&f](uint32_t index) { *f++ = index; });
+  }
+
+  std::vector<float> w(size_t(PATTERN_PHASES) * pattern_index.phase_size, 0.0f);
+  std::vector<uint32_t> order(samples.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+  // a step corrects about a tenth of a sample's error at first
+  const float initial_rate = 0.1f / N_PATTERN_FEATURES;
+
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    for (size_t i = order.size(); i > 1; --i) std::swap(order[i - 1], order[rng.bounded(i)]);
+
+    const float rate = initial_rate * (epochs - epoch) / epochs;
+    double squared_error = 0;
+
+    for (const uint32_t s : order) {
+      const uint32_t *f = &features[size_t(s) * N_PATTERN_FEATURES];
+
+      float predicted = 0;
+      for (int j = 0; j < N_PATTERN_FEATURES; ++j) predicted += w[f[j]];
+
+      const float error = samples[s].score - predicted;
+      squared_error += error * error;
+
+      for (int j = 0; j < N_PATTERN_FEATURES; ++j) w[f[j]] += rate * error;
+    }
+
+    if (errors) errors->push_back(samples.empty() ? 0 : squared_error / samples.size());
+  }
+
+  PatternWeights result;
+  result.weights.resize(w.size());
+  for (size_t i = 0; i < w.size(); ++i) {
+    const float scaled = std::round(w[i] * PATTERN_UNIT);
+    result.weights[i] = int16_t(std::max(-32767.0f, std::min(32767.0f, scaled)));
+  }
+  return result;
+}
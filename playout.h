@@ -0,0 +1,351 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+#include "board.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+// Playout policies choose the move to play from the mask of legal moves
+// and the bitboards of the mover (p) and the opponent (o), returning its
+// bit. They read the board only through masks and tables, never copy it.
+
+// Every legal move equally likely, on a board of any size.
+struct UniformPolicy {
+  template<typename B>
+  B pick(const B moves, B, B, Rng &rng) const {
+    return square_bit<B>(nth_square(moves, rng.bounded(popcount(moves))));
+  }
+};
+
+const uint64_t CORNER_SQUARES = 0x8100000000000081ULL;
+
+// The X and C squares next to each corner.
+const uint64_t CORNER_NEIGHBOURS[4] = {
+  0x0000000000000302ULL, 0x000000000000C040ULL, 0x0203000000000000ULL, 0x40C0000000000000ULL
+};
+
+// Squares next to an empty corner, which give the corner away.
+inline uint64_t corner_danger(const uint64_t empty) {
+  uint64_t danger = 0;
+  if (empty & square_bit(0)) danger |= CORNER_NEIGHBOURS[0];
+  if (empty & square_bit(7)) danger |= CORNER_NEIGHBOURS[1];
+  if (empty & square_bit(56)) danger |= CORNER_NEIGHBOURS[2];
+  if (empty & square_bit(63)) danger |= CORNER_NEIGHBOURS[3];
+  return danger;
+}
+
+// Takes a corner when it can, else avoids the X and C squares of empty
+// corners when it can, choosing uniformly among what is left.
+struct CornerPolicy {
+  uint64_t pick(const uint64_t moves, const uint64_t p, const uint64_t o, Rng &rng) const {
+    uint64_t candidates = moves & CORNER_SQUARES;
+    if (!candidates) candidates = moves & ~corner_danger(~(p | o));
+    if (!candidates) candidates = moves;
+    return square_bit(nth_square(candidates, rng.bounded(popcount(candidates))));
+  }
+};
+
+// Relative odds of playing each square: corners far above edges, edges
+// above the middle. X and C squares next to an empty corner are played
+// with odds DANGER_WEIGHT instead, below every other square.
+const uint8_t SQUARE_WEIGHTS[64] = {
+  64,  6, 12,  8,  8, 12,  6, 64,
+   6,  4,  3,  3,  3,  3,  4,  6,
+  12,  3,  6,  4,  4,  6,  3, 12,
+   8,  3,  4,  1,  1,  4,  3,  8,
+   8,  3,  4,  1,  1,  4,  3,  8,
+  12,  3,  6,  4,  4,  6,  3, 12,
+   6,  4,  3,  3,  3,  3,  4,  6,
+  64,  6, 12,  8,  8, 12,  6, 64,
+};
+
+const int DANGER_WEIGHT = 1;
+
+// The squares of each distinct weight, so a move can be drawn by
+// choosing a weight class from the counts of moves in each, then a
+// move within the class uniformly.
+struct WeightClasses {
+  uint64_t masks[64];
+  int weights[64];
+  int n;
+
+  WeightClasses() : n(0) {
+    for (int sq = 0; sq < 64; ++sq) {
+      int c = 0;
+      while (c < n && weights[c] != SQUARE_WEIGHTS[sq]) ++c;
+      if (c == n) {
+        masks[n] = 0;
+        weights[n++] = SQUARE_WEIGHTS[sq];
+      }
+      masks[c] |= square_bit(sq);
+    }
+  }
+};
+
+const WeightClasses weight_classes;
+
+// Each legal move with probability proportional to its weight.
+struct WeightedPolicy {
+  uint64_t pick(const uint64_t moves, const uint64_t p, const uint64_t o, Rng &rng) const {
+    const uint64_t danger = moves & corner_danger(~(p | o));
+    const uint64_t safe = moves & ~danger;
+    const int danger_total = popcount(danger) * DANGER_WEIGHT;
+
+    int totals[64];
+    int total = danger_total;
+    for (int c = 0; c < weight_classes.n; ++c) {
+      totals[c] = total += popcount(safe & weight_classes.masks[c]) * weight_classes.weights[c];
+    }
+
+    const int r = rng.bounded(total);
+    if (r < danger_total) return square_bit(nth_square(danger, rng.bounded(popcount(danger))));
+
+    int c = 0;
+    while (totals[c] <= r) ++c;
+    const uint64_t candidates = safe & weight_classes.masks[c];
+    return square_bit(nth_square(candidates, rng.bounded(popcount(candidates))));
+  }
+};
+
+// Game from start_state with moves chosen by policy. Works on a pair of
+// local bitboards (no hash upkeep) and returns the winner as
+// Board::winner does. The squares each player moves to are added to
+// played[BLACK] and played[WHITE].
+template<typename Policy, int N>
+inline int policy_playout(const Board<N> *start_state, Rng &rng, board_bits<N> *played, const Policy &policy) {
+  typedef board_bits<N> Bits;
+  Bits p = start_state->pieces(start_state->active_player);
+  Bits o = start_state->pieces(OTHER(start_state->active_player));
+  Bits p_moves = 0, o_moves = 0;
+  int to_move = start_state->active_player;
+  bool passed = start_state->passed;
+
+  while (true) {
+    const Bits valid_moves = move_mask<N>(p, o);
+
+    if (valid_moves) {
+      const Bits m = policy.pick(valid_moves, p, o, rng);
+      const Bits flips = flip_mask<N>(m, p, o);
+      p |= flips | m;
+      o &= ~flips;
+      p_moves |= m;
+      passed = false;
+    } else if (passed) {
+      break;
+    } else {
+      passed = true;
+    }
+
+    std::swap(p, o);
+    std::swap(p_moves, o_moves);
+    to_move = OTHER(to_move);
+  }
+
+  played[to_move] |= p_moves;
+  played[OTHER(to_move)] |= o_moves;
+
+  const int p_score = popcount(p);
+  const int o_score = popcount(o);
+
+  if (p_score > o_score) return to_move;
+  if (p_score < o_score) return OTHER(to_move);
+  return EMPTY;
+}
+
+// Uniformly random game from start_state.
+template<int N>
+inline int random_playout(const Board<N> *start_state, Rng &rng, board_bits<N> *played) {
+  return policy_playout(start_state, rng, played, UniformPolicy());
+}
+
+// The same without the moves; inlining drops their upkeep.
+template<int N>
+inline int random_playout(const Board<N> *start_state, Rng &rng) {
+  board_bits<N> played[3] = { 0, 0, 0 };
+  return random_playout(start_state, rng, played);
+}
+
+// The policies the searches can be given, chosen per playout.
+enum Playout { PLAYOUT_UNIFORM, PLAYOUT_CORNERS, PLAYOUT_WEIGHTED };
+
+inline int playout(const BoardState *start_state, Rng &rng, uint64_t *played, const Playout policy) {
+  switch (policy) {
+    case PLAYOUT_CORNERS: return policy_playout(start_state, rng, played, CornerPolicy());
+    case PLAYOUT_WEIGHTED: return policy_playout(start_state, rng, played, WeightedPolicy());
+    default: return policy_playout(start_state, rng, played, UniformPolicy());
+  }
+}
+
+inline int playout(const BoardState *start_state, Rng &rng, const Playout policy) {
+  uint64_t played[3] = { 0, 0, 0 };
+  return playout(start_state, rng, played, policy);
+}
+
+// Lockstep playouts: LANES independent random games from the same start
+// position advance one ply per step, with each lane's bitboards held in
+// one element of a GCC vector. Move generation and flipping run on the
+// whole vector (AVX2 / AVX-512 when the target has them); only picking
+// the random move is done per lane. Finished lanes keep an empty move
+// mask, so they ride along as no-ops until the last game ends.
+
+#if defined(__AVX512F__)
+#define BATCH_LANES 8
+#elif defined(__AVX2__)
+#define BATCH_LANES 4
+#else
+#define BATCH_LANES 1
+#endif
+
+template<int LANES>
+struct Lanes {
+  typedef uint64_t type __attribute__((vector_size(LANES * sizeof(uint64_t))));
+};
+
+// Play one game per lane from start, drawing lane l's moves from rngs[l]
+// exactly as random_playout would. Winners are written to winners[l].
+template<int LANES>
+void playout_lanes(const BoardState *start, Rng *rngs, int *winners) {
+  typedef typename Lanes<LANES>::type V;
+
+  V p, o;
+  V passed;
+  V done;
+
+  for (int l = 0; l < LANES; ++l) {
+    p[l] = start->pieces(start->active_player);
+    o[l] = start->pieces(OTHER(start->active_player));
+    passed[l] = start->passed ? ~0ULL : 0;
+    done[l] = 0;
+  }
+
+  // every lane changes sides on every step, moves and passes alike, so
+  // p belongs to the same colour in all lanes
+  int to_move = start->active_player;
+
+  while (true) {
+    const V moves = move_mask(p, o) & ~done;
+
+    V m;
+    bool all_done = true;
+
+    for (int l = 0; l < LANES; ++l) {
+      m[l] = 0;
+      if (moves[l]) {
+        const int k = rngs[l].bounded(popcount(moves[l]));
+        m[l] = square_bit(nth_square(moves[l], k));
+      }
+      all_done &= (done[l] || (!moves[l] && passed[l]));
+    }
+
+    if (all_done) break;
+
+    done |= V(moves == 0) & passed;
+    passed = V(moves == 0);
+
+    const V flips = flip_mask(m, p, o);
+    const V next_o = p | flips | m;
+    p = o & ~flips;
+    o = next_o;
+
+    to_move = OTHER(to_move);
+  }
+
+  for (int l = 0; l < LANES; ++l) {
+    const int p_score = popcount(p[l]);
+    const int o_score = popcount(o[l]);
+
+    if (p_score > o_score) winners[l] = to_move;
+    else if (p_score < o_score) winners[l] = OTHER(to_move);
+    else winners[l] = EMPTY;
+  }
+}
+
+struct PlayoutCounts {
+  int wins[3];
+
+  PlayoutCounts() : wins{0, 0, 0} {}
+};
+
+// Results of n random games from start, indexed by winner (EMPTY = draw).
+// A last group of fewer than LANES games is played one lane at a time,
+// so no game is played only to be dropped.
+template<int LANES = BATCH_LANES>
+PlayoutCounts batch_playouts(const BoardState *start, int n, Rng &rng) {
+  PlayoutCounts counts;
+
+  Rng rngs[LANES];
+  int winners[LANES];
+
+  for (int i = 0; i < n; i += LANES) {
+    for (int l = 0; l < LANES; ++l)
+      rngs[l].seed(rng.next());
+
+    if (n - i < LANES) {
+      for (int l = 0; i + l < n; ++l)
+        counts.wins[random_playout(start, rngs[l])]++;
+      break;
+    }
+
+    playout_lanes<LANES>(start, rngs, winners);
+
+    for (int l = 0; l < LANES; ++l)
+      counts.wins[winners[l]]++;
+  }
+
+  return counts;
+}
+
+// Scalar fallback with the same stream assignment as batch_playouts.
+inline PlayoutCounts scalar_playouts(const BoardState *start, int n, Rng &rng, int lanes = BATCH_LANES) {
+  PlayoutCounts counts;
+
+  Rng lane_rng;
+
+  for (int i = 0; i < n; i += lanes) {
+    for (int l = 0; l < lanes; ++l) {
+      lane_rng.seed(rng.next());
+      if (i + l < n) counts.wins[random_playout(start, lane_rng)]++;
+    }
+  }
+
+  return counts;
+}
+
+// Playouts per task of parallel_playouts.
+const int PLAYOUT_BLOCK = 64;
+
+// batch_playouts split into blocks of PLAYOUT_BLOCK games run on pool (or
+// on the calling thread if pool is NULL). Block b draws from stream b of
+// a seed taken from rng, so the counts do not depend on the thread count.
+inline PlayoutCounts parallel_playouts(const BoardState *start, int n, Rng &rng, ThreadPool *pool) {
+  const uint64_t seed = rng.next();
+  const int n_blocks = (n + PLAYOUT_BLOCK - 1) / PLAYOUT_BLOCK;
+  PlayoutCounts counts;
+
+  // without a pool, as used for every leaf of a sampling search, the
+  // blocks are summed in place
+  if (!pool) {
+    for (int b = 0; b < n_blocks; ++b) {
+      Rng block_rng = Rng::stream(seed, b);
+      const PlayoutCounts block = batch_playouts(start, std::min(PLAYOUT_BLOCK, n - b * PLAYOUT_BLOCK), block_rng);
+      for (int w = 0; w < 3; ++w) counts.wins[w] += block.wins[w];
+    }
+    return counts;
+  }
+
+  std::vector<PlayoutCounts> blocks(n_blocks);
+
+  pool->run(n_blocks, [&](int b, int) {
+    Rng block_rng = Rng::stream(seed, b);
+    blocks[b] = batch_playouts(start, std::min(PLAYOUT_BLOCK, n - b * PLAYOUT_BLOCK), block_rng);
+  });
+
+  for (const PlayoutCounts &block : blocks)
+    for (int w = 0; w < 3; ++w) counts.wins[w] += block.wins[w];
+
+  return counts;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "util.h"
+#include "board.h"
+
+// Game record file: a RecordFileHeader, then one record per game, appended
+// as games end. A record is
+//
+//   uint8  n_moves
+//   int8   score             final black discs minus white discs
+//   uint8  flags             RECORD_VISITS if root visits follow the moves
+//   uint8  moves[n_moves]    squares, or RECORD_PASS
+//
+// and with RECORD_VISITS, for each move in turn
+//
+//   uint8  n                 moves with visits (0 if the player reported none)
+//   uint8  squares[n]
+//   uint16 shares[n]         share of the root visits out of 65535, little endian
+
+const char RECORD_MAGIC[4] = { 'R', 'R', 'E', 'C' };
+const uint32_t RECORD_VERSION = 1;
+
+const uint8_t RECORD_PASS = 64;
+const uint8_t RECORD_VISITS = 1;
+
+struct RecordFileHeader {
+  char magic[4];
+  uint32_t version;
+};
+
+static_assert(sizeof(RecordFileHeader) == 8, "record headers are written as is");
+
+struct GameRecord {
+  std::vector<uint8_t> moves;
+  int score;
+  bool has_visits;
+  std::vector<uint8_t> n_visits;   // per move
+  std::vector<RootVisit> visits;   // every move's, in order
+
+  void clear() {
+    moves.clear();
+    score = 0;
+    has_visits = false;
+    n_visits.clear();
+    visits.clear();
+  }
+};
+
+// Call f(before, move) for every move of record from the opening
+// position. Returns the final position.
+template<typename F>
+BoardState replay(const GameRecord &record, const F f) {
+  BoardState state;
+  for (const uint8_t move : record.moves) {
+    f(state, move);
+    if (move == RECORD_PASS) state.apply_pass();
+    else state.apply_square(move);
+  }
+  return state;
+}
+
+// Appends records to a file, from any number of threads.
+struct GameWriter {
+  FILE *file;
+  std::mutex mutex;
+  uint64_t written;
+
+  GameWriter() : file(NULL), written(0) {}
+
+  ~GameWriter() {
+    close();
+  }
+
+  // Creates path if needed. False if it cannot be written or already
+  // holds something other than records.
+  bool open(const char *path) {
+    close();
+
+    if (FILE *existing = fopen(path, "rb")) {
+      RecordFileHeader header;
+      const size_t n = fread(&header, sizeof(header), 1, existing);
+      const bool empty = n == 0 && feof(existing);
+      fclose(existing);
+      if (!empty && (n != 1 || std::memcmp(header.magic, RECORD_MAGIC, 4) != 0
+                     || header.version != RECORD_VERSION)) {
+        return false;
+      }
+    }
+
+    file = fopen(path, "ab");
+    if (!file) return false;
+
+    if (ftell(file) == 0) {
+      RecordFileHeader header;
+      std::memcpy(header.magic, RECORD_MAGIC, 4);
+      header.version = RECORD_VERSION;
+      if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        close();
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool write(const GameRecord &record) {
+    std::vector<uint8_t> bytes;
+    bytes.push_back(record.moves.size());
+    bytes.push_back(uint8_t(int8_t(record.score)));
+    bytes.push_back(record.has_visits ? RECORD_VISITS : 0);
+    bytes.insert(bytes.end(), record.moves.begin(), record.moves.end());
+
+    if (record.has_visits) {
+      size_t v = 0;
+      for (const uint8_t n : record.n_visits) {
+        bytes.push_back(n);
+        for (int i = 0; i < n; ++i) bytes.push_back(record.visits[v + i].square);
+        for (int i = 0; i < n; ++i) {
+          bytes.push_back(record.visits[v + i].share & 0xFF);
+          bytes.push_back(record.visits[v + i].share >> 8);
+        }
+        v += n;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file || fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) return false;
+    written++;
+    return true;
+  }
+
+  bool close() {
+    if (!file) return true;
+    const bool ok = fclose(file) == 0;
+    file = NULL;
+    return ok;
+  }
+};
+
+// Reads the records of a file one at a time through a buffer, so files
+// of any size can be streamed.
+struct GameReader {
+  static const size_t BUFFER = 1 << 20;
+
+  FILE *file;
+
+  GameReader() : file(NULL) {}
+
+  ~GameReader() {
+    if (file) fclose(file);
+  }
+
+  GameReader(const GameReader &) = delete;
+  GameReader & operator=(const GameReader &) = delete;
+
+  // False if path is missing or not a record file.
+  bool open(const char *path) {
+    if (file) fclose(file);
+    file = fopen(path, "rb");
+    if (!file) return false;
+    setvbuf(file, NULL, _IOFBF, BUFFER);
+
+    RecordFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, RECORD_MAGIC, 4) != 0
+        || header.version != RECORD_VERSION) {
+      fclose(file);
+      file = NULL;
+      return false;
+    }
+    return true;
+  }
+
+  // The next record, reusing record's storage. False at the end of the
+  // file, or at a record cut short.
+  bool next(GameRecord &record) {
+    record.clear();
+
+    uint8_t head[3];
+    if (!file || fread(head, 1, 3, file) != 3) return false;
+
+    record.score = int8_t(head[1]);
+    record.has_visits = head[2] & RECORD_VISITS;
+    record.moves.resize(head[0]);
+    if (fread(record.moves.data(), 1, head[0], file) != head[0]) return false;
+
+    if (record.has_visits) {
+      uint8_t squares[64], shares[128];
+      for (int m = 0; m < head[0]; ++m) {
+        const int n = fgetc(file);
+        if (n == EOF || n > 64) return false;
+        if (fread(squares, 1, n, file) != size_t(n) || fread(shares, 2, n, file) != size_t(n)) return false;
+        record.n_visits.push_back(n);
+        for (int i = 0; i < n; ++i) {
+          record.visits.push_back({ squares[i], uint16_t(shares[2 * i] | (shares[2 * i + 1] << 8)) });
+        }
+      }
+    }
+
+    return true;
+  }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+// xoshiro256** (Blackman & Vigna), seeded through splitmix64. There is
+// no shared generator: every search and game is handed the Rng to draw
+// from, so results depend only on the seed and not on threads.
+struct Rng {
+  uint64_t s[4];
+
+  explicit Rng(uint64_t seed = 0x9E3779B97F4A7C15ULL) {
+    this->seed(seed);
+  }
+
+  static inline uint64_t splitmix(uint64_t &x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  void seed(uint64_t seed) {
+    for (int i = 0; i < 4; ++i) {
+      s[i] = splitmix(seed);
+    }
+  }
+
+  // Generator number index derived from seed, e.g. game index of a match.
+  // Distinct indices give unrelated streams, in any order.
+  static Rng stream(uint64_t seed, uint64_t index) {
+    uint64_t x = splitmix(seed) ^ index;
+    return Rng(splitmix(x));
+  }
+
+  static inline uint64_t rotl(const uint64_t x, const int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  inline uint64_t next() {
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+  }
+
+  // Advance by 2^128 draws, so the skipped part of the sequence can be
+  // handed out as a stream that never overlaps this one.
+  void jump() {
+    static const uint64_t JUMP[4] = {
+      0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL
+    };
+
+    uint64_t t[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+      for (int b = 0; b < 64; ++b) {
+        if (JUMP[i] & (1ULL << b)) {
+          for (int j = 0; j < 4; ++j) t[j] ^= s[j];
+        }
+        next();
+      }
+    }
+    for (int j = 0; j < 4; ++j) s[j] = t[j];
+  }
+
+  // A generator for the next 2^128 draws; this one jumps past them.
+  Rng split() {
+    Rng r(*this);
+    jump();
+    return r;
+  }
+
+  // Uniform integer in [0, n), by multiply-shift on the high 32 bits.
+  inline uint32_t bounded(const uint32_t n) {
+    return uint32_t(((next() >> 32) * n) >> 32);
+  }
+};
@@ -4,6 +4,8 @@
 #include <functional>
 #include <cmath>
 #include <cassert>
+#include <chrono>
+#include <map>
 
 #include "board.h"
 #include "util.h"
@@ -11,6 +13,11 @@
 #include "basic.h"
 #include "uct.h"
 #include "ucb.h"
+#include "playout.h"
+#include "tournament.h"
+#include "pattern.h"
+#include "records.h"
+#include "engine.h"
 
 using namespace std;
 
@@ -19,7 +26,7 @@ auto simple_adjacent = [](int y, int x) {
   
   for (int x2 = x - 1; x2 <= x + 1; ++x2) {
     for (int y2 = y - 1; y2 <= y + 1; ++y2) {
-      if (!(x2 == x && y2 == y) && BOUNDS(y2, x2)) {
+      if (!(x2 == x && y2 == y) && on_board(y2, x2)) {
         adj.emplace_back(y2, x2);
       }
     }
@@ -46,7 +53,7 @@ auto simple_moves = [](BoardState* state) {
               x += dx;
               y += dy;
 
-              if (!BOUNDS(y, x)) break;
+              if (!on_board(y, x)) break;
 
               if (state->get(y, x) == state->active_player) break;
 
@@ -84,7 +91,7 @@ auto simple_apply = [](BoardState *state, Point move) {
           x += dx;
           y += dy;
 
-          if (!BOUNDS(y, x)) break;
+          if (!on_board(y, x)) break;
 
           if (state->get(y, x) == state->active_player) {
             while (true) {
@@ -156,15 +163,29 @@ void adjacent_unit() {
   printf("Adjacent squares ok\n");
 }
 
+void perft_unit() {
+  const uint64_t counts[] = { 4, 12, 56, 244, 1396, 8200, 55092 };
+  BoardState state;
+
+  for (int depth = 1; depth <= 7; ++depth) {
+    assert(perft(state, depth) == counts[depth - 1]);
+  }
+
+  printf("Perft ok\n");
+}
+
 void valid_moves_unit() {
-  
+  Rng rng(1);
+
   for (int i = 0; i < 100; ++i) {
     BoardState state;
     for (int j = 0; j < 10; ++j) {
-      random_move(&state);
+      random_move(&state, rng);
     }
 
     vector<Point> check = simple_moves(&state);
+    std::sort(check.begin(), check.end());
+    check.erase(std::unique(check.begin(), check.end()), check.end());
 
     vector<Point> mov1 = state.moves();
 
@@ -175,11 +196,12 @@ void valid_moves_unit() {
 }
 
 void apply_moves_unit() {
+  Rng rng(2);
 
   for (int i = 0; i < 100; ++i) {
     BoardState state;
     for (int j = 0; j < 10; ++j) {
-      random_move(&state);
+      random_move(&state, rng);
     }
 
     for (auto move : simple_moves(&state)) {
@@ -190,18 +212,985 @@ void apply_moves_unit() {
       s2.apply(move);
 
       assert_board_state(&s1, &s2);
+      assert(s2.hash == s2.compute_hash());
+
+      // undo restores the position exactly
+      BoardState s3(state);
+      const Undo undo = s3.apply(move);
+      s3.undo(undo);
+      assert(s3 == state && s3.hash == state.hash);
     }
+
+    BoardState passed(state);
+    const Undo pass = passed.apply_pass();
+    const Undo second_pass = passed.apply_pass();
+    passed.undo(second_pass);
+    passed.undo(pass);
+    assert(passed == state && passed.hash == state.hash);
   }
 
   printf("Apply move ok\n"); 
 
 }
 
+template<int LANES>
+void batch_playout_lanes_unit() {
+  Rng seeder(LANES);
+
+  for (int i = 0; i < 100; ++i) {
+    BoardState state;
+    for (int j = 0; j < i % 50; ++j) {
+      random_move(&state, seeder);
+    }
+
+    Rng rngs[LANES];
+    Rng check_rngs[LANES];
+    int winners[LANES];
+
+    for (int l = 0; l < LANES; ++l) {
+      rngs[l].seed(seeder.next());
+      check_rngs[l] = rngs[l];
+    }
+
+    playout_lanes<LANES>(&state, rngs, winners);
+
+    for (int l = 0; l < LANES; ++l) {
+      assert(winners[l] == random_playout(&state, check_rngs[l]));
+    }
+  }
+
+  // lane l on stream l plays the game rollout_game plays on that stream
+  for (uint64_t seed = 0; seed < 20; ++seed) {
+    BoardState state;
+    Rng rngs[LANES];
+    int winners[LANES];
+
+    for (int l = 0; l < LANES; ++l) rngs[l] = Rng::stream(seed, l);
+    playout_lanes<LANES>(&state, rngs, winners);
+
+    for (int l = 0; l < LANES; ++l) {
+      Rng rng = Rng::stream(seed, l);
+      assert(winners[l] == rollout_game(RandomPolicy(), &state, rng));
+    }
+  }
+}
+
+void rng_unit() {
+  // streams are a function of (seed, index) alone
+  Rng a = Rng::stream(42, 7);
+  Rng b = Rng::stream(42, 7);
+  Rng c = Rng::stream(42, 8);
+  for (int i = 0; i < 100; ++i) {
+    const uint64_t x = a.next();
+    assert(x == b.next());
+    assert(x != c.next());
+  }
+
+  // split hands out the current stream and jumps past it
+  Rng parent(3);
+  Rng copy(parent);
+  Rng child = parent.split();
+  for (int i = 0; i < 100; ++i) {
+    const uint64_t x = child.next();
+    assert(x == copy.next());
+    assert(x != parent.next());
+  }
+
+  // a game depends only on its stream, not on what was played before
+  move_func random = bind(random_move, placeholders::_1, placeholders::_3);
+  vector<BoardState> finals;
+  for (int k = 0; k < 4; ++k) {
+    Rng rng = Rng::stream(99, k);
+    finals.push_back(play_game(random, random, 0, 0, false, rng));
+  }
+  for (int k = 3; k >= 0; --k) {
+    Rng rng = Rng::stream(99, k);
+    assert(play_game(random, random, 0, 0, false, rng) == finals[k]);
+  }
+
+  printf("Random streams ok\n");
+}
+
+void batch_playout_unit() {
+  batch_playout_lanes_unit<1>();
+  batch_playout_lanes_unit<4>();
+  batch_playout_lanes_unit<8>();
+  batch_playout_lanes_unit<16>();
+
+  BoardState state;
+  Rng r1(7);
+  Rng r2(7);
+
+  PlayoutCounts batch = batch_playouts(&state, 1001, r1);
+  PlayoutCounts scalar = scalar_playouts(&state, 1001, r2);
+
+  for (int i = 0; i < 3; ++i)
+    assert(batch.wins[i] == scalar.wins[i]);
+
+  // fewer games than lanes are played one by one, on the same streams
+  for (int n = 1; n < 8; ++n) {
+    Rng r3(n);
+    Rng r4(n);
+    PlayoutCounts few = batch_playouts<8>(&state, n, r3);
+    PlayoutCounts check = scalar_playouts(&state, n, r4, 8);
+    assert(few.wins[0] + few.wins[1] + few.wins[2] == n);
+    for (int i = 0; i < 3; ++i)
+      assert(few.wins[i] == check.wins[i]);
+  }
+
+  printf("Batch playouts ok\n");
+}
+
+template<typename Policy>
+void check_policy_picks(const Policy &policy, Rng &rng) {
+  for (int i = 0; i < 200; ++i) {
+    BoardState state;
+    for (int j = 0; j < i % 50; ++j) random_move(&state, rng);
+    const uint64_t moves = state.move_mask();
+    if (!moves) continue;
+
+    const uint64_t m = policy.pick(moves, state.pieces(state.active_player), state.pieces(OTHER(state.active_player)), rng);
+    assert(popcount(m) == 1 && (m & moves));
+  }
+}
+
+void playout_policy_unit() {
+  Rng rng(25);
+
+  check_policy_picks(UniformPolicy(), rng);
+  check_policy_picks(CornerPolicy(), rng);
+  check_policy_picks(WeightedPolicy(), rng);
+
+  // corners first, then anything but the X and C squares of empty corners
+  const uint64_t a1 = square_bit(0), b2 = square_bit(9), b1 = square_bit(1), e3 = square_bit(20);
+  for (int i = 0; i < 100; ++i) {
+    assert(CornerPolicy().pick(a1 | b2 | e3, 0, 0, rng) == a1);
+    assert(CornerPolicy().pick(b1 | b2 | e3, 0, 0, rng) == e3);
+    assert(CornerPolicy().pick(b1 | b2, 0, 0, rng) & (b1 | b2));
+  }
+  int x_square = 0;
+  for (int i = 0; i < 1000; ++i) x_square += CornerPolicy().pick(b2 | e3, a1, 0, rng) == b2;
+  assert(x_square > 400 && x_square < 600);
+
+  // odds follow the weights, 64 : 4 for a corner against e3, and 1 : 4
+  // for an X square next to an empty corner
+  int corner = 0, danger = 0;
+  for (int i = 0; i < 7000; ++i) {
+    corner += WeightedPolicy().pick(a1 | e3, 0, 0, rng) == a1;
+    danger += WeightedPolicy().pick(b2 | e3, 0, 0, rng) == b2;
+  }
+  assert(corner > 6450 && corner < 6700);
+  assert(danger > 1250 && danger < 1550);
+
+  // games under every policy end with a winner, and the searches take them
+  for (const Playout policy : { PLAYOUT_UNIFORM, PLAYOUT_CORNERS, PLAYOUT_WEIGHTED }) {
+    BoardState state;
+    uint64_t played[3] = { 0, 0, 0 };
+    const int winner = playout(&state, rng, played, policy);
+    assert(winner == EMPTY || winner == BLACK || winner == WHITE);
+    assert(!(played[BLACK] & played[WHITE]) && popcount(played[BLACK] | played[WHITE]) > 20);
+
+    BoardState s1, s2;
+    const uint64_t moves = s1.move_mask();
+    assert(uct_move(&s1, 20, 1, rng, TimeControl(), NULL, false, policy));
+    assert(ucb1_move(&s2, 20, rng, TimeControl(), NULL, policy));
+    assert(popcount(moves & ~s1.empty()) == 1 && popcount(moves & ~s2.empty()) == 1);
+  }
+
+  printf("Playout policies ok\n");
+}
+
+void uct_parallel_unit() {
+  Rng rng(3);
+
+  for (int n_threads : { 1, 4 }) {
+    UctTree tree(BoardState(), 1000 * UCT_NODES_PER_PLAYOUT);
+    tree.search(1000, n_threads, rng);
+
+    int visits = 0;
+    const uint32_t first = tree.root().first_edge;
+    for (uint32_t i = first; i < first + tree.root().n_edges; ++i) {
+      visits += tree.nodes[tree.edges[i].node].visits;
+    }
+
+    // every virtual loss has been replaced by exactly one real visit
+    assert(visits == 1000);
+    assert(tree.root().visits == 1000);
+
+    tree.reset(BoardState());
+    assert(tree.nodes.size == 1);
+  }
+
+  printf("Parallel UCT ok\n");
+}
+
+void uct_rave_unit() {
+  Rng rng(24);
+
+  for (int n_threads : { 1, 4 }) {
+    BoardState state;
+    for (int i = 0; i < 10; ++i) random_move(&state, rng);
+
+    UctTree tree(state, 2000 * UCT_NODES_PER_PLAYOUT, false, true);
+    tree.search(2000, n_threads, rng);
+    assert(tree.root().visits == 2000);
+
+    // every playout through a child played its move first, and some of
+    // the others played it later
+    const uint32_t first = tree.root().first_edge;
+    int64_t amaf_total = 0, child_total = 0;
+    for (uint32_t i = first; i < first + tree.root().n_edges; ++i) {
+      const UctNode &child = tree.nodes[tree.edges[i].node];
+      const UctAmaf &amaf = tree.amaf[i];
+      assert(amaf.visits >= child.visits && amaf.visits <= tree.root().visits);
+      assert(amaf.wins <= amaf.visits && amaf.wins >= 0);
+      amaf_total += amaf.visits;
+      child_total += child.visits;
+    }
+    assert(amaf_total > child_total);
+
+    // the statistics move with the subtree kept
+    UctTree copy(state, 2000 * UCT_NODES_PER_PLAYOUT, false, true);
+    tree.copy_subtree(0, state, copy);
+    const uint32_t copy_first = copy.root().first_edge;
+    for (int i = 0; i < tree.root().n_edges; ++i) {
+      assert(copy.amaf[copy_first + i].visits == tree.amaf[first + i].visits);
+    }
+  }
+
+  BoardState state;
+  const uint64_t before = state.move_mask();
+  assert(uct_move(&state, 50, 1, rng, TimeControl(), NULL, true));
+  assert(popcount(before & ~state.empty()) == 1);
+
+  printf("UCT RAVE ok\n");
+}
+
+// Follow moves from the root, returning the node reached or NODE_UNEXPANDED.
+uint32_t tree_path(UctTree &tree, const vector<Point> &moves) {
+  BoardState state(tree.root_state);
+  uint32_t index = 0;
+
+  for (Point m : moves) {
+    BoardState next(state);
+    next.apply(m);
+    index = tree.find_child(index, state, next);
+    if (index == NODE_UNEXPANDED) break;
+    state = next;
+  }
+
+  return index;
+}
+
+void uct_table_unit() {
+  BoardState state;
+
+  // find two 4-ply move orders reaching the same position
+  vector<Point> first_order, second_order;
+  std::map<uint64_t, vector<Point>> seen;
+
+  std::function<void(BoardState, vector<Point>)> walk = [&](BoardState s, vector<Point> moves) {
+    if (!second_order.empty()) return;
+    if (moves.size() == 4) {
+      assert(s.hash == s.compute_hash());
+      auto it = seen.find(s.hash);
+      if (it == seen.end()) {
+        seen[s.hash] = moves;
+      } else {
+        first_order = it->second;
+        second_order = moves;
+      }
+      return;
+    }
+    for (Point m : s.moves()) {
+      BoardState next(s);
+      next.apply(m);
+      vector<Point> next_moves(moves);
+      next_moves.push_back(m);
+      walk(next, next_moves);
+    }
+  };
+  walk(state, {});
+  assert(!second_order.empty());
+
+  Rng rng(9);
+  UctTree tree(state, 20000 * UCT_NODES_PER_PLAYOUT);
+  tree.search(20000, 1, rng);
+
+  const uint32_t via_first = tree_path(tree, first_order);
+  const uint32_t via_second = tree_path(tree, second_order);
+  assert(via_first != NODE_UNEXPANDED && via_first == via_second);
+  assert(tree.table.hit_rate() > 0);
+
+  // the shared node is the one stored for the position
+  BoardState shared;
+  for (Point m : first_order) shared.apply(m);
+  assert(tree.table.lookup(shared.hash) == via_first);
+
+  tree.reset(BoardState());
+  assert(tree.table.lookup(shared.hash) == UctTable::MISS);
+  assert(tree_path(tree, first_order) == NODE_UNEXPANDED);
+
+  printf("UCT transposition table ok\n");
+}
+
+void uct_reuse_unit() {
+  Rng rng(5);
+
+  UctPlayer player(20, 1);
+  BoardState state;
+
+  for (int ply = 0; ply < 10; ++ply) {
+    player.move(&state, rng);
+    assert(player.tree.root_state == state);
+
+    random_move(&state, rng);
+
+    // the opponent's reply is a child the search has already visited
+    const int kept = player.sync(state);
+    assert(player.tree.root_state == state);
+    assert(kept > 0);
+  }
+
+  // a position the tree has never seen starts a new tree
+  BoardState fresh;
+  assert(player.sync(fresh) == 0);
+
+  printf("UCT subtree reuse ok\n");
+}
+
+void uct_ponder_unit() {
+  Rng rng(20);
+  BoardState state;
+  UctPlayer player(100, 1, true);
+
+  player.move(&state, rng);
+  const int after_move = player.tree.root().visits;
+  assert(player.ponderers.size() == 1);
+
+  // the opponent takes its time
+  this_thread::sleep_for(chrono::milliseconds(50));
+  random_move(&state, rng);
+
+  player.stop_pondering();
+  assert(player.pondered > 0);
+  assert(player.tree.root().visits > after_move);
+
+  // the subtree of the reply survives into the next move
+  assert(player.sync(state) > 0);
+  assert(player.move(&state, rng));
+  player.stop_pondering();
+
+  // nothing to ponder once the game is over
+  BoardState over;
+  over.black = ~0ULL;
+  over.white = 0;
+  over.hash = over.compute_hash();
+  assert(!player.worth_pondering(over));
+
+  printf("UCT pondering ok\n");
+}
+
+// Plain negamax without pruning, scored like MinimaxSearch::evaluate.
+int brute_negamax(BoardState *state, int depth, int player) {
+  auto moves = state->moves();
+
+  if (depth == 0 || (moves.empty() && state->passed)) {
+    int score = state->count(player);
+    return state->active_player == player ? score : -score;
+  }
+
+  if (moves.empty()) moves.push_back(PASS);
+
+  int best = -SCORE_INF;
+  for (auto move : moves) {
+    BoardState next_state(*state);
+    next_state.apply(move);
+    best = max(best, -brute_negamax(&next_state, depth - 1, player));
+  }
+  return best;
+}
+
+void parallel_rollout_unit() {
+  Rng rng(6);
+  BoardState state;
+  for (int j = 0; j < 16; ++j) {
+    random_move(&state, rng);
+  }
+
+  ThreadPool pool(3);
+
+  // counts do not depend on the pool
+  Rng r1(8), r2(8);
+  PlayoutCounts c1 = parallel_playouts(&state, 1000, r1, NULL);
+  PlayoutCounts c2 = parallel_playouts(&state, 1000, r2, &pool);
+  assert(c1.wins[0] + c1.wins[1] + c1.wins[2] == 1000);
+  for (int w = 0; w < 3; ++w) assert(c1.wins[w] == c2.wins[w]);
+
+  // batched UCB1 plays the same move on any number of threads
+  ThreadPool single(1);
+  for (int i = 0; i < 5; ++i) {
+    BoardState s1(state), s2(state);
+    Rng u1(i), u2(i);
+    ucb1_move(&s1, 200, u1, TimeControl(), &single);
+    ucb1_move(&s2, 200, u2, TimeControl(), &pool);
+    assert(s1 == s2);
+  }
+
+  printf("Parallel rollouts ok\n");
+}
+
+void minimax_unit() {
+  Rng rng(13);
+
+  for (int i = 0; i < 30; ++i) {
+    BoardState state;
+    for (int j = 0; j < 10 + i; ++j) {
+      random_move(&state, rng);
+    }
+    if (!state.move_mask()) continue;
+
+    MinimaxSearch<PiecesEval> search;
+    search.player = state.active_player;
+    search.rng = &rng;
+
+    const int score = search.negamax(&state, 4, -SCORE_INF, SCORE_INF, 0);
+    assert(score == brute_negamax(&state, 4, state.active_player));
+
+    // the chosen move is legal
+    const int move = search.search(&state, 4, rng);
+    assert(state.move_mask() & square_bit(move));
+  }
+
+  // a searcher stopped by its deadline searches afresh next time
+  BoardState state;
+  MinimaxSearch<PiecesEval> search;
+  search.search(&state, 60, rng, Deadline(TimeControl(0.001), 60));
+  assert(search.stopped);
+  const int move = search.search(&state, 3, rng);
+  assert(!search.stopped && search.depth_reached == 3);
+  assert(state.move_mask() & square_bit(move));
+
+  printf("Minimax ok\n");
+}
+
+// Final disc difference for the side to move with perfect play.
+template<int N = 8>
+int brute_solve(board_bits<N> p, board_bits<N> o, bool passed) {
+  board_bits<N> moves = move_mask<N>(p, o);
+  if (!moves) {
+    if (passed) return popcount(p) - popcount(o);
+    return -brute_solve<N>(o, p, true);
+  }
+
+  int best = -Solver<N>::INF;
+  for (; moves; moves &= moves - 1) {
+    const board_bits<N> m = moves & -moves;
+    const board_bits<N> flips = flip_mask<N>(m, p, o);
+    best = max(best, -brute_solve<N>(o & ~flips, p | flips | m, false));
+  }
+  return best;
+}
+
+void endgame_unit() {
+  Rng rng(21);
+  EndgameSolver solver(12);
+  int solved = 0;
+
+  while (solved < 50) {
+    BoardState state;
+    while (popcount(state.empty()) > 9 && !(state.passed && !state.move_mask())) {
+      random_move(&state, rng);
+    }
+    if (!state.move_mask()) continue;
+
+    const uint64_t p = state.pieces(state.active_player);
+    const uint64_t o = state.pieces(OTHER(state.active_player));
+    const int score = brute_solve(p, o, state.passed);
+
+    solver.clear();
+    assert(solver.solve(p, o, -ENDGAME_INF, ENDGAME_INF, state.passed) == score);
+
+    // null windows bound the score on the correct side
+    for (int alpha = -9; alpha < 9; alpha += 3) {
+      solver.clear();
+      assert((solver.solve(p, o, alpha, alpha + 1, state.passed) > alpha) == (score > alpha));
+    }
+
+    int best_score;
+    solver.best_move(state, true, &best_score);
+    assert(best_score == score);
+
+    // the win/loss/draw move keeps the result
+    BoardState next(state);
+    next.apply_square(solver.best_move(state, false));
+    const int kept = -brute_solve(next.pieces(next.active_player), next.pieces(OTHER(next.active_player)), false);
+    assert((kept > 0) == (score > 0) && (kept < 0) == (score < 0));
+
+    solved++;
+  }
+
+  printf("Endgame solver ok\n");
+}
+
+// Moves of the mover on an N x N board found square by square, walking
+// every ray with bounds checks.
+template<int N>
+board_bits<N> naive_sized_moves(const Board<N> &board) {
+  typedef board_bits<N> Bits;
+  const Bits p = board.pieces(board.active_player), o = board.pieces(OTHER(board.active_player));
+  Bits moves = 0;
+
+  for (int y = 0; y < N; ++y) {
+    for (int x = 0; x < N; ++x) {
+      if ((p | o) & square_bit<Bits>(y * N + x)) continue;
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          int ny = y + dy, nx = x + dx, run = 0;
+          while ((dy || dx) && on_board<N>(ny, nx) && (o & square_bit<Bits>(ny * N + nx))) {
+            ny += dy;
+            nx += dx;
+            run++;
+          }
+          if (run && on_board<N>(ny, nx) && (p & square_bit<Bits>(ny * N + nx)))
+            moves |= square_bit<Bits>(y * N + x);
+        }
+      }
+    }
+  }
+
+  return moves;
+}
+
+template<int N>
+void check_sized_games(Rng &rng) {
+  for (int game = 0; game < 50; ++game) {
+    Board<N> board;
+    while (true) {
+      const board_bits<N> moves = board.move_mask();
+      assert(moves == naive_sized_moves(board));
+      for (int sq = 0; sq < N * N; ++sq) assert(board.legal(sq) == ((moves >> sq) & 1));
+
+      if (!moves) {
+        if (board.passed) break;
+        board.apply_pass();
+        continue;
+      }
+
+      const Board<N> before(board);
+      const auto undo = board.apply_square(nth_square(moves, rng.bounded(popcount(moves))));
+      assert(!(board.black & board.white) && !((board.black | board.white) & ~GEOMETRY<N>.all));
+      assert(board.hash == board.compute_hash());
+
+      Board<N> undone(board);
+      undone.undo(undo);
+      assert(undone == before && undone.hash == before.hash);
+    }
+  }
+}
+
+// The endgame solver on an N x N board against brute force.
+template<int N>
+void check_sized_solver(Rng &rng) {
+  Solver<N> solver(12);
+
+  for (int solved = 0; solved < 10; ) {
+    Board<N> board;
+    while (popcount(board.empty()) > 8 && !(board.passed && !board.move_mask())) {
+      const board_bits<N> moves = board.move_mask();
+      if (moves) board.apply_square(nth_square(moves, rng.bounded(popcount(moves))));
+      else board.apply_pass();
+    }
+    if (!board.move_mask()) continue;
+
+    const board_bits<N> p = board.pieces(board.active_player), o = board.pieces(OTHER(board.active_player));
+    const int score = brute_solve<N>(p, o, board.passed);
+
+    solver.clear();
+    assert(solver.solve(p, o, -Solver<N>::INF, Solver<N>::INF, board.passed) == score);
+
+    int best_score;
+    solver.best_move(board, true, &best_score);
+    assert(best_score == score);
+
+    solved++;
+  }
+}
+
+void sized_unit() {
+  Rng rng(22);
+
+  check_sized_games<6>(rng);
+  check_sized_games<8>(rng);
+  check_sized_games<10>(rng);
+
+  assert(perft(Board<6>(), 8) == 308716);
+  assert(perft(Board<10>(), 7) == 55180);
+
+  check_sized_solver<6>(rng);
+  check_sized_solver<10>(rng);
+
+  // 4x4 solved from the opening: white wins by 8 discs
+  Board<4> small;
+  Solver<4> small_solver;
+  assert(small_solver.solve(small.black, small.white, -Solver<4>::INF, Solver<4>::INF) == -8);
+
+  printf("Board sizes ok\n");
+}
+
+void symmetry_unit() {
+  Rng rng(16);
+
+  for (int i = 0; i < 50; ++i) {
+    BoardState state;
+    for (int j = 0; j < i % 30; ++j) random_move(&state, rng);
+
+    const uint64_t key = canonical_position(state).hash;
+
+    for (int t = 0; t < 8; ++t) {
+      // the bit tricks agree with moving every square
+      uint64_t image_black = 0;
+      for (uint64_t b = state.black; b; b &= b - 1)
+        image_black |= square_bit(transform_square(lowest_square(b), t));
+      assert(transform_bitboard(state.black, t) == image_black);
+
+      BoardState image(state);
+      image.black = image_black;
+      image.white = transform_bitboard(state.white, t);
+      image.hash = image.compute_hash();
+
+      // all eight images share one canonical form
+      int canonical_t;
+      BoardState canonical = canonical_position(image, &canonical_t);
+      assert(canonical.hash == key);
+      assert(canonical.hash == canonical.compute_hash());
+
+      // and its moves map back to the image's moves
+      uint64_t moves = 0;
+      for (uint64_t m = canonical.move_mask(); m; m &= m - 1)
+        moves |= square_bit(inverse_transform_square(lowest_square(m), canonical_t));
+      assert(moves == image.move_mask());
+
+      for (int sq = 0; sq < 64; ++sq) assert(inverse_transform_square(transform_square(sq, t), t) == sq);
+    }
+  }
+
+  printf("Symmetry ok\n");
+}
+
+// A record file of n_games random games, or an empty path.
+string random_games(int n_games) {
+  const char *path = "/tmp/reversi_test.rec";
+  unlink(path);
+  Strategy random_player = { "Random", stateless(bind(random_move, placeholders::_1, placeholders::_3)) };
+  GameWriter writer;
+  if (!writer.open(path) || !self_play(random_player, random_player, n_games, 2, 1, writer, false)) return "";
+  return writer.close() ? path : "";
+}
+
+void records_unit() {
+  Strategy random_player = { "Random", stateless(bind(random_move, placeholders::_1, placeholders::_3)) };
+  Strategy uct_player = { "UCT", [](RootVisits *visits) -> move_func {
+    return bind(uct_move, placeholders::_1, 10, 1, placeholders::_3, placeholders::_2, nullptr, false, PLAYOUT_UNIFORM, visits);
+  } };
+
+  const char *path = "/tmp/reversi_test.rec";
+  unlink(path);
+
+  // appending: a first run without visits, a second one with
+  for (int run = 0; run < 2; ++run) {
+    GameWriter writer;
+    assert(writer.open(path));
+    assert(self_play(uct_player, random_player, 5, 2, run, writer, run == 1));
+    assert(writer.written == 5 && writer.close());
+  }
+
+  GameReader reader;
+  assert(reader.open(path));
+
+  GameRecord record;
+  int n_records = 0;
+  while (reader.next(record)) {
+    const bool visits = n_records++ >= 5;
+    assert(record.has_visits == visits);
+
+    size_t v = 0;
+    int ply = 0;
+    const BoardState end = replay(record, [&](const BoardState &before, uint8_t move) {
+      assert(move == RECORD_PASS ? !before.move_mask() : (before.move_mask() & square_bit(move)) != 0);
+      if (!visits) return;
+
+      // UCT, playing black, reports its root; Random reports nothing
+      const int n = record.n_visits[ply++];
+      assert(n == 0 || before.active_player == BLACK);
+      int total = 0;
+      for (int i = 0; i < n; ++i, ++v) {
+        assert(before.move_mask() & square_bit(record.visits[v].square));
+        total += record.visits[v].share;
+      }
+      assert(n == 0 || abs(total - 65535) <= n);
+      if (before.active_player == BLACK && before.move_mask() && popcount(before.empty()) > endgame_settings.root_empties)
+        assert(n == popcount(before.move_mask()));
+    });
+
+    assert(record.score == end.count(BLACK) - end.count(WHITE));
+    BoardState after(end);
+    after.apply_pass();
+    assert(!end.move_mask() && !after.move_mask());
+    if (visits) assert(v == record.visits.size() && ply == int(record.moves.size()));
+  }
+  assert(n_records == 10);
+
+  // other files are not appended to
+  FILE *f = fopen(path, "wb");
+  fputs("not records", f);
+  fclose(f);
+  GameWriter writer;
+  assert(!writer.open(path) && !reader.open(path));
+  unlink(path);
+
+  printf("Game records ok\n");
+}
+
+void book_unit() {
+  const string games = random_games(200);
+  assert(!games.empty());
+  GameReader reader;
+  assert(reader.open(games.c_str()));
+  vector<BookEntry> entries = build_book(reader, 2);
+  unlink(games.c_str());
+  assert(is_sorted(entries.begin(), entries.end(), [](const BookEntry &a, const BookEntry &b) {
+    return a.key < b.key || (a.key == b.key && a.move < b.move);
+  }));
+
+  // the four first moves are one move up to symmetry
+  const uint64_t start = canonical_position(BoardState()).hash;
+  int start_games = 0;
+  for (const BookEntry &e : entries) if (e.key == start) start_games += e.games;
+  assert(start_games == 200);
+
+  const char *path = "/tmp/reversi_test.book";
+  assert(write_book(path, entries));
+  OpeningBook book;
+  assert(book.load(path));
+  assert(book.count == entries.size());
+
+  // every opening move is answered in every orientation
+  for (uint64_t m = BoardState().move_mask(); m; m &= m - 1) {
+    BoardState state;
+    state.apply_square(lowest_square(m));
+    const uint8_t move = book.move(state, 1);
+    assert(move != NO_MOVE && (state.move_mask() & square_bit(move)));
+  }
+
+  unlink(path);
+  assert(!book.load(path));
+
+  printf("Opening book ok\n");
+}
+
+void pattern_unit() {
+  Rng rng(17);
+
+  PatternWeights weights;
+  weights.weights.resize(size_t(PATTERN_PHASES) * pattern_index.phase_size);
+  for (int16_t &w : weights.weights) w = int16_t(rng.bounded(201)) - 100;
+
+  for (int i = 0; i < 50; ++i) {
+    BoardState state;
+    for (int j = 0; j < i; ++j) random_move(&state, rng);
+
+    for (int k = 0; k < N_PATTERNS; ++k) {
+      uint32_t bits = 0;
+      int n = 0;
+      for (uint64_t m = PATTERN_MASKS[k]; m; m &= m - 1, ++n)
+        if (state.black & m & -m) bits |= 1u << n;
+      assert(gather_bits(state.black, PATTERN_MASKS[k]) == bits);
+    }
+
+    // every feature indexes its own pattern's weights in the right phase
+    const uint64_t p = state.pieces(state.active_player), o = state.pieces(OTHER(state.active_player));
+    int n_features = 0;
+    pattern_features(p, o, [&](uint32_t f) {
+      assert(f / pattern_index.phase_size == uint32_t(pattern_phase(p, o)));
+      const uint32_t index = f % pattern_index.phase_size;
+      const int k = n_features++ % N_PATTERNS;
+      if (n_features == N_PATTERN_FEATURES) {
+        assert(index == pattern_index.phase_size - 1);
+      } else {
+        const uint32_t end = k + 1 < N_PATTERNS ? pattern_index.offsets[k + 1] : pattern_index.phase_size - 1;
+        assert(index >= pattern_index.offsets[k] && index < end);
+      }
+    });
+    assert(n_features == N_PATTERN_FEATURES);
+
+    // the score is the same in every orientation
+    for (int t = 1; t < 8; ++t)
+      assert(weights.score(transform_bitboard(p, t), transform_bitboard(o, t)) == weights.score(p, o));
+  }
+
+  // fitting random games lowers the error
+  const string games = random_games(100);
+  GameReader reader;
+  assert(!games.empty() && reader.open(games.c_str()));
+  vector<PatternSample> samples = record_samples(reader);
+  unlink(games.c_str());
+  assert(samples.size() > 100 * 50);
+  vector<double> errors;
+  PatternWeights trained = train_patterns(samples, 10, rng, &errors);
+  assert(errors.size() == 10 && errors.back() < errors.front() / 2);
+
+  const char *path = "/tmp/reversi_test.weights";
+  assert(trained.save(path));
+  PatternWeights loaded;
+  assert(loaded.load(path) && loaded.weights == trained.weights);
+  unlink(path);
+  assert(!loaded.load(path));
+
+  // weights that were never loaded score nothing, and UCT searches
+  // without them as a prior
+  PatternWeights missing;
+  assert(!missing.loaded() && missing.score(BoardState()) == 0);
+  BoardState state;
+  const uint64_t moves = state.move_mask();
+  assert(uct_move(&state, 50, 1, rng, TimeControl(), &missing, false, PLAYOUT_UNIFORM));
+  assert(popcount(moves & ~state.empty()) == 1);
+
+  UctTree tree(BoardState(), 100 * UCT_NODES_PER_PLAYOUT);
+  tree.prior = &missing;
+  tree.search(100, 1, rng);
+  assert(tree.root().visits == 100);
+
+  printf("Patterns ok\n");
+}
+
+void engine_unit() {
+  Engine engine(1);
+  istringstream in(
+    "board\n"
+    "go uct playouts 2000\n"
+    "play f5 d6\n"
+    "go uct playouts 2000\n"
+    "go minimax depth 3\n"
+    "play a1\n"
+    "position ...........................ox......xo........................... o moves f4\n"
+    "stats\n"
+    "frobnicate\n"
+    "quit\n"
+    "board\n");
+  ostringstream out;
+  run_engine(engine, in, out);
+
+  vector<string> lines;
+  istringstream answers(out.str());
+  for (string line; getline(answers, line); ) lines.push_back(line);
+
+  assert(lines.size() == 10);  // nothing after quit
+  assert(lines[0] == "board ...........................ox......xo........................... x");
+  assert(lines[1].compare(0, 9, "bestmove ") == 0 && lines[1].find(" source uct ") != string::npos);
+  assert(lines[2] == "ok");
+
+  // the tree followed both moves, so the second search kept the first's playouts below them
+  assert(lines[3].find("source uct") != string::npos && lines[3].find(" kept 0 ") == string::npos);
+
+  // legal moves after f5 d6
+  for (int i : {3, 4}) {
+    BoardState state;
+    state.apply_square(parse_square("f5"));
+    state.apply_square(parse_square("d6"));
+    const uint8_t move = parse_square(lines[i].substr(9, 2));
+    assert(lines[i].compare(0, 9, "bestmove ") == 0 && move != NO_MOVE && (state.move_mask() & square_bit(move)));
+  }
+
+  assert(lines[5] == "error illegal move a1");
+  assert(lines[6] == "ok" && engine.state.count(WHITE) == 4 && engine.state.active_player == BLACK);
+  assert(lines[7].compare(0, 6, "stats ") == 0 && lines[7].find(" searches 3 ") != string::npos);
+  assert(lines[8] == "error unknown command frobnicate");
+  assert(lines[9] == "ok");
+
+  for (int sq = 0; sq < 64; ++sq) assert(parse_square(square_name(sq)) == sq);
+
+  printf("Engine ok\n");
+}
+
+void time_control_unit() {
+  Rng rng(4);
+  BoardState state;
+  for (int j = 0; j < 20; ++j) {
+    random_move(&state, rng);
+  }
+
+  const TimeControl tc(0.02);
+
+  for (int i = 0; i < 3; ++i) {
+    BoardState s(state);
+    auto start = chrono::steady_clock::now();
+
+    if (i == 0) uct_move(&s, 1 << 20, 1, rng, tc);
+    if (i == 1) ucb1_move(&s, 1 << 20, rng, tc);
+    if (i == 2) minimax_move(&s, eval_pieces, 60, rng, tc);
+
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert(s.active_player != state.active_player);
+    assert(elapsed < 5 * tc.move_seconds);
+  }
+
+  // the game clock is spread over the remaining moves
+  Deadline deadline(TimeControl(0, 1.0), 60);
+  assert(deadline.limited && !deadline.expired());
+  assert(!Deadline(TimeControl(), 60).limited);
+
+  // a clock that has run out still limits the search, to a moment
+  for (const double clock : { 0.0, -3.0 }) {
+    Deadline spent(TimeControl(0, clock), 40);
+    assert(spent.limited);
+
+    BoardState s;
+    auto start = chrono::steady_clock::now();
+    minimax_move(&s, eval_pieces, 60, rng, TimeControl(0, clock));
+    assert(chrono::duration<double>(chrono::steady_clock::now() - start).count() < 0.5);
+  }
+
+  printf("Time control ok\n");
+}
+
+void tournament_unit() {
+  ThreadPool pool(3);
+  vector<int> runs(1000, 0);
+  for (int batch = 0; batch < 2; ++batch) {
+    pool.run(runs.size(), [&](int task, int worker) {
+      assert(worker >= 0 && worker < pool.size());
+      runs[task]++;
+    });
+  }
+  assert(count(runs.begin(), runs.end(), 2) == (int)runs.size());
+
+  vector<Strategy> contestants = {
+    {"Random", stateless(bind(random_move, placeholders::_1, placeholders::_3))},
+    {"Greedy", stateless(bind(greedy_move<PiecesEval>, placeholders::_1, PiecesEval(), placeholders::_3))}
+  };
+
+  // per-game seeds make results independent of the thread count
+  TournamentResult r1 = run_tournament(contestants, 20, 1, 1234, 0, 0);
+  TournamentResult r2 = run_tournament(contestants, 20, 3, 1234, 0, 0);
+  assert(r1.black_wins == r2.black_wins && r1.white_wins == r2.white_wins);
+
+  // ratings are centred on zero and follow the results
+  assert(fabs(r1.elo[0] + r1.elo[1]) < 1e-6);
+  const int greedy_wins = r1.black_wins[1][0] + r1.white_wins[0][1];
+  const int random_wins = r1.black_wins[0][1] + r1.white_wins[1][0];
+  assert((greedy_wins > random_wins) == (r1.elo[1] > r1.elo[0]));
+  assert(r1.elo_error[0] > 0 && r1.elo_error[0] < 400);
+
+  printf("Tournament ok\n");
+}
+
 void random_game_perf() {
   BoardState state;
+  Rng rng(1);
 
   for (int i = 0; i < 100000; ++i) {
-    rollout_game(random_move, &state);
+    random_playout(&state, rng);
   }
 }
 
@@ -209,9 +1198,49 @@ int main(int argc, char ** argv) {
 
   adjacent_unit();
 
+  perft_unit();
+
   valid_moves_unit();
 
   apply_moves_unit();
 
+  rng_unit();
+
+  batch_playout_unit();
+
+  playout_policy_unit();
+
+  parallel_rollout_unit();
+
+  minimax_unit();
+
+  endgame_unit();
+
+  sized_unit();
+
+  symmetry_unit();
+
+  records_unit();
+
+  book_unit();
+
+  pattern_unit();
+
+  engine_unit();
+
+  time_control_unit();
+
+  uct_parallel_unit();
+
+  uct_rave_unit();
+
+  uct_table_unit();
+
+  uct_reuse_unit();
+
+  uct_ponder_unit();
+
+  tournament_unit();
+
   random_game_perf();
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// Fixed set of worker threads that run one batch of tasks at a time.
+// run(n, f) calls f(task, worker) for task = 0..n-1, spreading the tasks
+// over the workers and the calling thread, and returns when all are done.
+struct ThreadPool {
+  typedef std::function<void(int, int)> task_func;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+
+  const task_func *job;
+  int n_tasks;
+  std::atomic<int> next_task;
+  int busy;
+  uint64_t generation;
+  bool stopping;
+
+  ThreadPool(int n_threads) : job(NULL), n_tasks(0), next_task(0), busy(0), generation(0), stopping(false) {
+    for (int w = 1; w < n_threads; ++w) {
+      workers.emplace_back([this, w]() { work(w); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    start.notify_all();
+    for (auto &worker : workers) worker.join();
+  }
+
+  int size() const {
+    return workers.size() + 1;
+  }
+
+  void run(int n, const task_func &f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &f;
+      n_tasks = n;
+      next_task = 0;
+      busy = workers.size();
+      generation++;
+    }
+    start.notify_all();
+
+    drain(f, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busy == 0; });
+    job = NULL;
+  }
+
+private:
+  void drain(const task_func &f, int worker) {
+    for (int task; (task = next_task.fetch_add(1)) < n_tasks; ) {
+      f(task, worker);
+    }
+  }
+
+  void work(int worker) {
+    uint64_t seen = 0;
+
+    while (true) {
+      const task_func *f;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        f = job;
+      }
+
+      drain(*f, worker);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0) done.notify_one();
+    }
+  }
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <functional>
+
+#include "util.h"
+#include "board.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include "records.h"
+
+using namespace std;
+
+// A named entry of the strategy table. make(visits) returns the move
+// function for one game, so strategies that keep state between moves
+// (like uct_player) get a fresh instance in every game. Strategies that
+// search a tree report its root visits to visits unless it is NULL.
+struct Strategy {
+  string name;
+  function<move_func(RootVisits*)> make;
+};
+
+// For strategies without state or visits to report, every game can
+// share one move function.
+inline function<move_func(RootVisits*)> stateless(move_func f) {
+  return [f](RootVisits *) { return f; };
+}
+
+// Play one game; each side has move_seconds per move and clock_seconds
+// for the game (zero for no limit), and both draw from rng. A side that
+// overruns its clock plays on with next to no time. Returns the final
+// position.
+BoardState play_game(move_func player_1, move_func player_2,
+                     double move_seconds, double clock_seconds, bool print_states, Rng &rng) {
+  BoardState state;
+
+  // remaining game time of the player to move and of the other one
+  double clock_1 = clock_seconds > 0 ? clock_seconds : NO_CLOCK;
+  double clock_2 = clock_1;
+
+  bool passed = false;
+  while (true) {
+    if (print_states) {
+      state.print();
+    }
+
+    auto start = chrono::steady_clock::now();
+    bool pass = !player_1(&state, TimeControl(move_seconds, clock_1), rng);
+    clock_1 -= chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (pass && passed) {
+      break;
+    }
+    passed = pass;
+
+    swap(player_1, player_2);
+    swap(clock_1, clock_2);
+  }
+
+  return state;
+}
+
+struct TournamentResult {
+  vector<string> names;
+  vector<vector<int>> black_wins;  // [i][j]: wins of i playing black against j
+  vector<vector<int>> white_wins;  // [i][j]: wins of j playing white against i
+  vector<double> elo;
+  vector<double> elo_error;        // half-width of the 95% interval
+};
+
+// Bradley-Terry ratings on the Elo scale from all games, fitted by the
+// minorization-maximization iteration and centred on zero. Every pair
+// also gets one virtual draw, which keeps ratings finite for players
+// that won or lost every game. Errors come from the Fisher information.
+void fit_elo(TournamentResult &result, int rounds) {
+  const int n = result.names.size();
+
+  vector<vector<double>> games(n, vector<double>(n, 0));
+  vector<double> score(n, 0);
+
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      if (i == j) continue;
+      const int draws = rounds - result.black_wins[i][j] - result.white_wins[i][j];
+      games[i][j] += rounds + 1;
+      games[j][i] += rounds + 1;
+      score[i] += result.black_wins[i][j] + 0.5 * draws + 0.5;
+      score[j] += result.white_wins[i][j] + 0.5 * draws + 0.5;
+    }
+  }
+
+  vector<double> gamma(n, 1.0);
+
+  for (int iteration = 0; iteration < 1000; ++iteration) {
+    vector<double> next(n);
+    double log_sum = 0;
+
+    for (int i = 0; i < n; ++i) {
+      double denominator = 0;
+      for (int j = 0; j < n; ++j)
+        if (i != j) denominator += games[i][j] / (gamma[i] + gamma[j]);
+      next[i] = denominator > 0 ? score[i] / denominator : 1.0;
+      log_sum += log(next[i]);
+    }
+
+    const double scale = exp(-log_sum / n);
+    for (int i = 0; i < n; ++i) gamma[i] = next[i] * scale;
+  }
+
+  result.elo.assign(n, 0);
+  result.elo_error.assign(n, 0);
+
+  for (int i = 0; i < n; ++i) {
+    double information = 0;
+    for (int j = 0; j < n; ++j) {
+      if (i == j) continue;
+      const double p = gamma[i] / (gamma[i] + gamma[j]);
+      information += games[i][j] * p * (1 - p);
+    }
+
+    result.elo[i] = 400 * log10(gamma[i]);
+    result.elo_error[i] = 1.96 * (400 / log(10.0)) / sqrt(information);
+  }
+}
+
+// Every contestant plays `rounds` games as black against every contestant
+// (itself included), all games spread over n_threads. Game k draws from
+// stream k of seed, so results do not depend on scheduling.
+TournamentResult run_tournament(const vector<Strategy> &contestants, int rounds, int n_threads,
+                                uint64_t seed, double move_seconds, double clock_seconds) {
+  const int n = contestants.size();
+
+  TournamentResult result;
+  for (auto &c : contestants) result.names.push_back(c.name);
+  result.black_wins.assign(n, vector<int>(n, 0));
+  result.white_wins.assign(n, vector<int>(n, 0));
+
+  vector<int> winners(n * n * rounds);
+
+  ThreadPool pool(n_threads);
+  pool.run(winners.size(), [&](int game, int) {
+    const int i = game / (n * rounds);
+    const int j = game / rounds % n;
+
+    Rng rng = Rng::stream(seed, game);
+    BoardState state = play_game(contestants[i].make(NULL), contestants[j].make(NULL),
+                                 move_seconds, clock_seconds, false, rng);
+    winners[game] = state.winner();
+  });
+
+  for (size_t game = 0; game < winners.size(); ++game) {
+    const int i = game / (n * rounds);
+    const int j = game / rounds % n;
+    if (winners[game] == BLACK) result.black_wins[i][j]++;
+    if (winners[game] == WHITE) result.white_wins[i][j]++;
+  }
+
+  fit_elo(result, rounds);
+
+  return result;
+}
+
+// Write black.csv, white.csv and header.csv (as read by
+// plot_tournament.py) and elo.csv into directory.
+void write_tournament(const TournamentResult &result, const string &directory) {
+  const int n = result.names.size();
+
+  auto write_matrix = [&](const string &file, const vector<vector<int>> &m) {
+    ofstream out(directory + "/" + file);
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) out << (j ? "," : "") << m[i][j];
+      out << "\r\n";
+    }
+  };
+
+  write_matrix("black.csv", result.black_wins);
+  write_matrix("white.csv", result.white_wins);
+
+  ofstream header(directory + "/header.csv");
+  for (int i = 0; i < n; ++i) header << (i ? "," : "") << result.names[i];
+  header << "\r\n";
+
+  ofstream elo(directory + "/elo.csv");
+  elo << "name,elo,ci95\r\n";
+  for (int i = 0; i < n; ++i) {
+    elo << result.names[i] << "," << lround(result.elo[i]) << "," << lround(result.elo_error[i]) << "\r\n";
+  }
+}
+
+// Play n_games games of black against white on n_threads threads and
+// write each to writer as soon as it ends, so records come in order of
+// completion. Game k draws from stream k of seed. With visits, records
+// keep the root visits the players report to their sinks. False if a
+// write failed.
+bool self_play(const Strategy &black, const Strategy &white, int n_games, int n_threads,
+               uint64_t seed, GameWriter &writer, bool visits) {
+  std::vector<char> ok(n_games, 1);
+
+  ThreadPool pool(n_threads);
+  pool.run(n_games, [&](int game, int) {
+    Rng rng = Rng::stream(seed, game);
+    RootVisits reported;
+    move_func player_1 = black.make(visits ? &reported : NULL);
+    move_func player_2 = white.make(visits ? &reported : NULL);
+
+    GameRecord record;
+    record.clear();
+    record.has_visits = visits;
+
+    BoardState state;
+    bool passed = false;
+
+    while (true) {
+      const BoardState before(state);
+      reported.clear();
+      const bool pass = !player_1(&state, TimeControl(), rng);
+
+      if (pass && passed) break;
+      passed = pass;
+
+      record.moves.push_back(pass ? RECORD_PASS : lowest_square(before.empty() & ~state.empty()));
+      if (visits) {
+        record.n_visits.push_back(reported.size());
+        record.visits.insert(record.visits.end(), reported.begin(), reported.end());
+      }
+
+      std::swap(player_1, player_2);
+    }
+
+    record.score = state.count(BLACK) - state.count(WHITE);
+    ok[game] = writer.write(record);
+  });
+
+  return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
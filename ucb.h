@@ -2,11 +2,49 @@
 #include <vector>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 #include "board.h"
 #include "util.h"
+#include "rng.h"
+#include "playout.h"
+#include "thread_pool.h"
 
-int ucb1_move(BoardState *state, int n_trials) {
+// Pulls per round of the batched variant.
+const int UCB1_BATCH = 256;
+
+// Arm with the largest T_j / N_j + sqrt(2 ln n / N_j), or the first
+// unplayed arm. Pending pulls P_j (chosen but not yet played out) count
+// toward N_j in the exploration term only; an arm with only pending
+// pulls is valued optimistically.
+inline int ucb1_select(const vector<double> &T, const vector<double> &N, const vector<double> &P, size_t trial) {
+  int max_j = -1;
+  double max_val = -1;
+
+  for (size_t j = 0; j < T.size(); ++j) {
+    if (N[j] + P[j] == 0) {
+      return j;
+    }
+    const double mean = N[j] ? T[j] / N[j] : 1;
+    const double val = mean + sqrt( ( 2 * log(trial) ) / (N[j] + P[j]));
+    if (val > max_val) {
+      max_val = val;
+      max_j = j;
+    }
+  }
+  assert(max_j != -1);
+
+  return max_j;
+}
+
+// UCB1 over the valid moves, one playout by policy per pull. With a pool,
+// arms are chosen UCB1_BATCH pulls at a time (each choice counting the
+// pulls already pending) and the batch is played out in parallel before
+// the statistics are updated. Pull k of a batch draws from stream k of a
+// seed taken from rng, so the result does not depend on the pool size.
+int ucb1_move(BoardState *state, int n_trials, Rng &rng, const TimeControl &tc = TimeControl(), ThreadPool *pool = NULL,
+              Playout policy = PLAYOUT_UNIFORM) {
+  const Deadline deadline(tc, popcount(state->empty()));
   auto valid_moves = state->moves();
   int player = state->active_player;
 
@@ -17,30 +55,51 @@ int ucb1_move(BoardState *state, int n_trials) {
 
   vector<double> T(valid_moves.size());
   vector<double> N(valid_moves.size());
+  vector<double> P(valid_moves.size());
+
+  const size_t n_pulls = n_trials*valid_moves.size();
+
+  if (!pool) {
+    for (size_t trial = 0; trial < n_pulls; ++trial) {
+      if (trial % DEADLINE_POLL == 0 && trial >= valid_moves.size() && deadline.expired()) break;
 
-  for (size_t trial = 0; trial < n_trials*valid_moves.size(); ++trial) {
-    // choose j with max x_j + sqrt((2 * ln n) / n_j)
-    int max_j = -1;
-    double max_val = -1;
-
-    for (size_t j = 0; j < valid_moves.size(); ++j) {
-      if (N[j] == 0) {
-        max_j = j;
-        break;
-      }
-      double val = T[j] / N[j] + sqrt( ( 2 * log(trial) ) / N[j]);
-      if (val > max_val) {
-        max_val = val;
-        max_j = j;
-      }
+      const int max_j = ucb1_select(T, N, P, trial);
+
+      BoardState next_state(*state);
+      next_state.apply(valid_moves[max_j]);
+
+      N[max_j] += 1;
+      T[max_j] += playout(&next_state, rng, policy) == player;
     }
-    assert(max_j != -1);
+  }
+
+  int arms[UCB1_BATCH];
+  bool wins[UCB1_BATCH];
+
+  for (size_t trial = 0; pool && trial < n_pulls; ) {
+    if (trial >= valid_moves.size() && deadline.expired()) break;
 
-    BoardState next_state(*state);
-    next_state.apply(valid_moves[max_j]);
+    const int batch = min<size_t>(UCB1_BATCH, n_pulls - trial);
 
-    N[max_j] += 1;
-    T[max_j] += rollout_game(random_move, &next_state) == player;
+    fill(P.begin(), P.end(), 0);
+    for (int k = 0; k < batch; ++k) {
+      arms[k] = ucb1_select(T, N, P, trial + k);
+      P[arms[k]] += 1;
+    }
+
+    const uint64_t seed = rng.next();
+    pool->run(batch, [&](int k, int) {
+      BoardState next_state(*state);
+      next_state.apply(valid_moves[arms[k]]);
+      Rng pull_rng = Rng::stream(seed, k);
+      wins[k] = playout(&next_state, pull_rng, policy) == player;
+    });
+
+    for (int k = 0; k < batch; ++k) {
+      N[arms[k]] += 1;
+      T[arms[k]] += wins[k];
+    }
+    trial += batch;
   }
 
   Point best_move;
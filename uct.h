@@ -4,126 +4,801 @@
 #include <vector>
 #include <cmath>
 #include <cassert>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <limits>
 
 #include "board.h"
 #include "util.h"
 #include "basic.h"
+#include "playout.h"
+#include "endgame.h"
+#include "book.h"
+#include "pattern.h"
 
 using namespace std;
 
-struct TreeNode {
-  int n_visited;
-  int n_moves;
-  
-  vector<double> T;
-  vector<double> N;
+// Visits charged to a node while a worker is still below it, so that
+// other workers prefer different branches. Removed once the result is in.
+const int VIRTUAL_LOSS = 3;
 
-  vector<Point> valid_moves;
-  vector<TreeNode*> node_children;
-  TreeNode* pass_node;
-  BoardState *state;
+// Arena slots reserved per playout of budget; each playout expands at
+// most one node. When the arena fills up, leaves simply stop expanding.
+const int UCT_NODES_PER_PLAYOUT = 16;
 
-  TreeNode(BoardState *state) : pass_node(NULL), state(state) {
-    valid_moves = state->moves();
-    n_moves = valid_moves.size();
-    n_visited = 0;
+// With a pattern prior, the probability the mover wins a child is taken
+// as a logistic of its pattern score, UCT_PRIOR_DISCS discs of lead
+// making e times better odds. It adds UCT_PRIOR_WEIGHT / (visits + 1) to
+// the child's UCB1 value, and unvisited children are tried best first.
+const double UCT_PRIOR_DISCS = 8;
+const double UCT_PRIOR_WEIGHT = 1;
 
-    T.resize(n_moves);
-    N.resize(n_moves);
+// With RAVE, a child's value blends its win rate over n visits with its
+// all-moves-as-first (AMAF) win rate over m playouts, weighting the
+// latter by m / (n + m + 4 UCT_RAVE_BIAS^2 n m): all of it before the
+// first visit, fading as visits come in (Gelly and Silver's schedule).
+// AMAF values need little exploration on top.
+const double UCT_RAVE_BIAS = 0.1;
+const double UCT_RAVE_EXPLORATION = 0.1;
 
-    node_children.resize(n_moves);
+// Upper bound on arena size, for budgets that are mostly limited by time.
+const uint32_t UCT_MAX_NODES = 1 << 22;
+
+inline uint32_t uct_capacity(const uint64_t n_playouts) {
+  return uint32_t(min<uint64_t>(n_playouts * UCT_NODES_PER_PLAYOUT + 64, UCT_MAX_NODES));
+}
+
+// Square code of the pass move in UctEdge::move.
+const uint8_t PASS_SQUARE = 64;
+
+// Values of UctNode::first_edge that are not edge indices. Edge index 0
+// is never handed out, so it can mark an unexpanded node.
+const uint32_t NODE_UNEXPANDED = 0;
+const uint32_t NODE_EXPANDING = 0xFFFFFFFF;
+const uint32_t NODE_TERMINAL = 0xFFFFFFFE;
+
+inline bool is_expanded(const uint32_t first_edge) {
+  return first_edge != NODE_UNEXPANDED && first_edge != NODE_EXPANDING && first_edge != NODE_TERMINAL;
+}
+
+// One position of the tree, 16 bytes. The position itself is not stored:
+// it is replayed from the root along the moves of the path. Statistics
+// are counted for the player who moved into the position, which is the
+// same player whichever parent it was reached from.
+struct UctNode {
+  atomic<uint32_t> first_edge;
+  atomic<int32_t> visits;
+  atomic<int32_t> wins;
+  uint8_t n_edges;
+
+  void init() {
+    first_edge.store(NODE_UNEXPANDED, memory_order_relaxed);
+    visits.store(0, memory_order_relaxed);
+    wins.store(0, memory_order_relaxed);
+    n_edges = 0;
   }
+};
+
+// A move out of a node. Written once, before the parent's first_edge is
+// published. prior is the prior win probability scaled to 0..65535.
+struct UctEdge {
+  uint32_t node;
+  uint8_t move;
+  uint16_t prior;
+};
+
+// AMAF statistics of an edge: playouts through its parent in which the
+// parent's mover played the edge's move then or at any later point, and
+// the mover's wins among them.
+struct UctAmaf {
+  atomic<int32_t> visits;
+  atomic<int32_t> wins;
 
-  ~TreeNode() {
-    delete state;
-    for (auto child : node_children)
-      if (child) delete child;
-    if (pass_node) delete pass_node;
+  void init() {
+    visits.store(0, memory_order_relaxed);
+    wins.store(0, memory_order_relaxed);
   }
+};
 
-  Point select_best_move() {
-    double best_score = -1;
-    Point best_move;
+static_assert(sizeof(UctNode) == 16, "UctNode should stay compact");
+static_assert(sizeof(UctEdge) == 8, "UctEdge should stay compact");
+
+// Bump allocator over a fixed array. Callers check has_room() before
+// allocating; the slack absorbs workers that passed the check together.
+template<typename T>
+struct Arena {
+  static const uint32_t SLACK = 64 * 64;
+
+  unique_ptr<T[]> items;
+  uint32_t capacity;
+  atomic<uint32_t> size;
+
+  Arena(uint32_t capacity) : items(new T[capacity + SLACK]), capacity(capacity), size(0) {}
+
+  T & operator[](const uint32_t i) { return items[i]; }
+  const T & operator[](const uint32_t i) const { return items[i]; }
+
+  bool has_room(const uint32_t n) const {
+    return size.load(memory_order_relaxed) + n <= capacity;
+  }
+
+  uint32_t allocate(const uint32_t n) {
+    const uint32_t first = size.fetch_add(n, memory_order_relaxed);
+    assert(first + n <= capacity + SLACK);
+    return first;
+  }
+
+  void swap(Arena &other) {
+    std::swap(items, other.items);
+    std::swap(capacity, other.capacity);
+    const uint32_t other_size = other.size;
+    other.size = size.load();
+    size = other_size;
+  }
+};
 
-    for (int i = 0; i < n_moves; ++i) {
-      assert(N[i] != 0);
-      if (T[i] / N[i] > best_score) {
-        best_score = T[i] / N[i];
-        best_move = valid_moves[i];
+// Zobrist hash -> node index, in buckets of four entries. An entry stores
+// its key xor'ed with its data, so a torn write by a racing worker just
+// reads as a miss. Entries from before the last clear() carry an old
+// generation and are ignored, which makes clearing O(1).
+struct UctTable {
+  static const int BUCKET = 4;
+
+  // lookup() of a key not stored; never a node index
+  static const uint32_t MISS = 0xFFFFFFFF;
+
+  struct Entry {
+    atomic<uint64_t> check;
+    atomic<uint64_t> data;
+  };
+
+  unique_ptr<Entry[]> entries;
+  uint64_t mask;
+  uint32_t generation;
+
+  atomic<uint64_t> lookups;
+  atomic<uint64_t> hits;
+
+  // 2^bits entries; zero bits disables the table
+  UctTable(int bits)
+      : entries(bits ? new Entry[1ULL << bits]() : NULL),
+        mask(bits ? (1ULL << bits) - BUCKET : 0),
+        generation(0), lookups(0), hits(0) {
+    clear();
+  }
+
+  bool enabled() const {
+    return entries != NULL;
+  }
+
+  void clear() {
+    generation++;
+    lookups = 0;
+    hits = 0;
+  }
+
+  // Node stored for key, or MISS.
+  uint32_t lookup(const uint64_t key) {
+    lookups.fetch_add(1, memory_order_relaxed);
+    Entry *bucket = &entries[key & mask];
+
+    for (int i = 0; i < BUCKET; ++i) {
+      const uint64_t data = bucket[i].data.load(memory_order_relaxed);
+      const uint64_t check = bucket[i].check.load(memory_order_relaxed);
+      if ((check ^ data) == key && uint32_t(data >> 32) == generation) {
+        hits.fetch_add(1, memory_order_relaxed);
+        return uint32_t(data);
       }
     }
 
-    assert(best_score != -1);
-    return best_move;
+    return MISS;
   }
 
-  int play() {
-    int winner = -1;
-    int next_move = -1;
+  // Replace a free or stale entry, else the one whose node has the fewest
+  // visits: those are the cheapest to lose sharing for.
+  void store(const uint64_t key, const uint32_t node, const Arena<UctNode> &nodes) {
+    Entry *bucket = &entries[key & mask];
+    Entry *victim = &bucket[0];
+    int32_t victim_visits = numeric_limits<int32_t>::max();
 
-    if (n_moves == 0) {
-      if (state->passed) {
-        return state->winner();
+    for (int i = 0; i < BUCKET; ++i) {
+      const uint64_t data = bucket[i].data.load(memory_order_relaxed);
+      if (uint32_t(data >> 32) != generation) {
+        victim = &bucket[i];
+        break;
       }
-      if (!pass_node) {
-        BoardState *pass_state = new BoardState(*state);
-        pass_state->apply(PASS);
-        pass_node = new TreeNode(pass_state);
+      const int32_t visits = nodes[uint32_t(data)].visits.load(memory_order_relaxed);
+      if (visits < victim_visits) {
+        victim = &bucket[i];
+        victim_visits = visits;
       }
-      return pass_node->play();
     }
 
-    if (n_visited < n_moves) {
-      next_move = n_visited++;
-      BoardState *next_state = new BoardState(*state);
+    const uint64_t data = (uint64_t(generation) << 32) | node;
+    victim->data.store(data, memory_order_relaxed);
+    victim->check.store(key ^ data, memory_order_relaxed);
+  }
+
+  double hit_rate() const {
+    return lookups ? double(hits) / lookups : 0;
+  }
+
+  void swap(UctTable &other) {
+    std::swap(entries, other.entries);
+    std::swap(mask, other.mask);
+    std::swap(generation, other.generation);
+    const uint64_t other_lookups = other.lookups, other_hits = other.hits;
+    other.lookups = lookups.load();
+    other.hits = hits.load();
+    lookups = other_lookups;
+    hits = other_hits;
+  }
+
+  size_t memory_used() const {
+    return enabled() ? (mask + BUCKET) * sizeof(Entry) : 0;
+  }
+};
+
+// Table size for a tree of the given capacity: about one entry per two
+// nodes, since most nodes are never expanded or looked up again.
+inline int table_bits(const uint32_t capacity) {
+  int bits = 2;
+  while ((1ULL << bits) < capacity / 2) bits++;
+  return bits;
+}
+
+struct UctTree {
+  Arena<UctNode> nodes;
+  Arena<UctEdge> edges;
+  UctTable table;
+  BoardState root_state;
+
+  // with RAVE, the AMAF statistics of every edge, by edge index; else NULL
+  unique_ptr<UctAmaf[]> amaf;
+
+  // pattern weights scoring new children, or NULL for none
+  const PatternWeights *prior;
+
+  // how rollouts choose their moves
+  Playout policy;
+
+  // With transpositions, positions reached by different move orders share
+  // one node (and its statistics), making the tree a DAG.
+  UctTree(const BoardState &state, uint32_t capacity, bool transpositions = true, bool rave = false)
+      : nodes(capacity), edges(capacity), table(transpositions ? table_bits(capacity) : 0),
+        amaf(rave ? new UctAmaf[capacity + Arena<UctEdge>::SLACK] : NULL), prior(NULL),
+        policy(PLAYOUT_UNIFORM) {
+    reset(state);
+  }
+
+  // Discard the whole tree in O(1); the arenas are reused as is.
+  void reset(const BoardState &state) {
+    root_state = state;
+    nodes.size = 1;
+    edges.size = 1;
+    nodes[0].init();
+    if (table.enabled()) table.clear();
+  }
+
+  UctNode & root() {
+    return nodes[0];
+  }
+
+  // Node for the position child, shared through the table when possible.
+  uint32_t child_node(const BoardState &child) {
+    if (table.enabled()) {
+      const uint32_t shared = table.lookup(child.hash);
+      if (shared != UctTable::MISS) return shared;
+    }
+
+    const uint32_t index = nodes.allocate(1);
+    nodes[index].init();
+    if (table.enabled()) table.store(child.hash, index, nodes);
 
-      next_state->apply(valid_moves[next_move]);
-      node_children[next_move] = new TreeNode(next_state);
+    return index;
+  }
 
-      // rollout from next_move
-      winner = rollout_game(random_move, node_children[next_move]->state);
+  // Create the edges of node, which holds state. Returns the value the
+  // node's first_edge ends up with; NODE_EXPANDING means another worker
+  // is still creating them (or the arenas are full).
+  uint32_t expand(UctNode &node, const BoardState &state) {
+    uint32_t expected = NODE_UNEXPANDED;
+    if (!node.first_edge.compare_exchange_strong(expected, NODE_EXPANDING, memory_order_acquire)) {
+      return expected;
+    }
+
+    uint64_t valid_moves = state.move_mask();
+    const int n = valid_moves ? popcount(valid_moves) : (state.passed ? 0 : 1);
+
+    if (n == 0) {
+      node.first_edge.store(NODE_TERMINAL, memory_order_release);
+      return NODE_TERMINAL;
+    }
+
+    if (!nodes.has_room(n) || !edges.has_room(n)) {
+      node.first_edge.store(NODE_UNEXPANDED, memory_order_release);
+      return NODE_EXPANDING;
+    }
+
+    const uint32_t first = edges.allocate(n);
+    if (amaf) {
+      for (uint32_t i = first; i < first + n; ++i) amaf[i].init();
+    }
+
+    if (valid_moves) {
+      BoardState child(state);
+      for (uint32_t i = first; valid_moves; valid_moves &= valid_moves - 1, ++i) {
+        edges[i].move = lowest_square(valid_moves);
+        const Undo undo = child.apply_square(edges[i].move);
+        edges[i].node = child_node(child);
+        edges[i].prior = prior ? prior_probability(child) : 0;
+        child.undo(undo);
+      }
     } else {
-      double max_val = -1;
+      BoardState child(state);
+      edges[first].move = PASS_SQUARE;
+      apply(child, PASS_SQUARE);
+      edges[first].node = child_node(child);
+      edges[first].prior = prior ? prior_probability(child) : 0;
+    }
+
+    node.n_edges = n;
+    node.first_edge.store(first, memory_order_release);
+    return first;
+  }
+
+  // Prior win probability for the player who moved into child.
+  uint16_t prior_probability(const BoardState &child) const {
+    const double lead = -prior->score(child) / (UCT_PRIOR_DISCS * PATTERN_UNIT);
+    return uint16_t(65535 / (1 + exp(-lead)));
+  }
 
-      for (unsigned i = 0; i < valid_moves.size(); ++i) {
-        assert(N[i] != 0);
+  // Edge of node maximising the UCB1 value (blended with AMAF values
+  // under RAVE); children nothing is known about come first.
+  uint32_t select_edge(const UctNode &node, const uint32_t first) const {
+    const double log_visits = log(node.visits.load(memory_order_relaxed) + 1);
 
-        double val = T[i] / N[i] + sqrt( ( 2 * log(n_visited) ) / N[i]);
-        if (val > max_val) {
-          max_val = val;
-          next_move = i;
-        }
+    uint32_t best = first;
+    double max_val = -1;
+    uint32_t unvisited = 0;
+
+    for (uint32_t i = first; i < first + node.n_edges; ++i) {
+      const UctNode &child = nodes[edges[i].node];
+      const double n = child.visits.load(memory_order_relaxed);
+      const double amaf_n = amaf ? amaf[i].visits.load(memory_order_relaxed) : 0;
+      if (n == 0 && amaf_n == 0) {
+        if (!prior) return i;
+        if (!unvisited || edges[i].prior > edges[unvisited].prior) unvisited = i;
+        continue;
+      }
+
+      double val;
+      if (amaf) {
+        const double beta = amaf_n / (n + amaf_n + 4 * UCT_RAVE_BIAS * UCT_RAVE_BIAS * n * amaf_n);
+        const double q = n ? child.wins.load(memory_order_relaxed) / n : 0;
+        const double amaf_q = amaf_n ? amaf[i].wins.load(memory_order_relaxed) / amaf_n : q;
+        val = (1 - beta) * q + beta * amaf_q + UCT_RAVE_EXPLORATION * sqrt((2 * log_visits) / (n + 1));
+      } else {
+        val = child.wins.load(memory_order_relaxed) / n + sqrt( ( 2 * log_visits ) / n);
+      }
+      if (prior) val += UCT_PRIOR_WEIGHT * edges[i].prior / 65535.0 / (n + 1);
+      if (val > max_val) {
+        max_val = val;
+        best = i;
+      }
+    }
+
+    return unvisited ? unvisited : best;
+  }
+
+  static Undo apply(BoardState &state, const uint8_t move) {
+    if (move == PASS_SQUARE) return state.apply_pass();
+    return state.apply_square(move);
+  }
+
+  // Winner of a playout from state under policy, or of perfect play near
+  // the end. The squares each player moved to in a playout go to played.
+  int rollout(const BoardState &state, Rng &rng, uint64_t *played) const {
+    int winner;
+    if (endgame_playout(state, &winner)) return winner;
+    return playout(&state, rng, played, policy);
+  }
+
+  // Credit the AMAF statistics of every node on the path: walking back
+  // from the leaf, played gathers each player's moves from that node on.
+  void update_amaf(const uint32_t *path, const uint32_t *path_edges, const int *movers, const int path_len,
+                   uint64_t *played, const int winner) {
+    for (int i = path_len - 1; i > 0; --i) {
+      const int mover = movers[i];
+      const uint8_t move = edges[path_edges[i]].move;
+      if (move != PASS_SQUARE) played[mover] |= square_bit(move);
+
+      const UctNode &parent = nodes[path[i - 1]];
+      const uint32_t first = parent.first_edge.load(memory_order_relaxed);
+      for (uint32_t e = first; e < first + parent.n_edges; ++e) {
+        const uint8_t m = edges[e].move;
+        if (m == PASS_SQUARE || !(played[mover] & square_bit(m))) continue;
+        amaf[e].visits.fetch_add(1, memory_order_relaxed);
+        if (winner == mover) amaf[e].wins.fetch_add(1, memory_order_relaxed);
+      }
+    }
+  }
+
+  // One iteration: descend from the root by UCB1, expanding the leaf it
+  // stops at, then roll out and back up the result along the path.
+  int play(Rng &rng) {
+    BoardState state(root_state);
+
+    // a game lasts at most 60 moves plus interleaved passes
+    uint32_t path[2 * BOARD_W * BOARD_H + 2];
+    uint32_t path_edges[2 * BOARD_W * BOARD_H + 2];  // edge into path[i]
+    int movers[2 * BOARD_W * BOARD_H + 2];
+    int path_len = 0;
+    uint64_t played[3] = { 0, 0, 0 };
+
+    uint32_t index = 0;
+    path[path_len] = 0;
+    movers[path_len++] = OTHER(state.active_player);
+    nodes[0].visits += VIRTUAL_LOSS;
+
+    int winner;
+
+    while (true) {
+      UctNode &node = nodes[index];
+
+      uint32_t first = node.first_edge.load(memory_order_acquire);
+      if (first == NODE_UNEXPANDED) first = expand(node, state);
+
+      if (first == NODE_TERMINAL) {
+        winner = state.winner();
+        break;
       }
 
-      assert(next_move != -1);
-      // play from next_move
-      winner = node_children[next_move]->play();
+      if (first == NODE_EXPANDING) {
+        winner = rollout(state, rng, played);
+        break;
+      }
+
+      const uint32_t e = select_edge(node, first);
+      const UctEdge &edge = edges[e];
+      index = edge.node;
+      const int previous_visits = nodes[index].visits.fetch_add(VIRTUAL_LOSS);
+
+      path[path_len] = index;
+      path_edges[path_len] = e;
+      movers[path_len++] = state.active_player;
+      apply(state, edge.move);
+
+      if (previous_visits == 0) {
+        // rollout from the new leaf
+        winner = rollout(state, rng, played);
+        break;
+      }
     }
 
-    // update statistics
-    N[next_move]++;
-    T[next_move] += (winner == state->active_player);
+    if (amaf) update_amaf(path, path_edges, movers, path_len, played, winner);
+
+    // update statistics, replacing the virtual loss with the real visit
+    for (int i = 0; i < path_len; ++i) {
+      UctNode &node = nodes[path[i]];
+      node.visits += 1 - VIRTUAL_LOSS;
+      if (winner == movers[i]) node.wins++;
+    }
 
     return winner;
   }
-};
 
-bool uct_move(BoardState *state, int n_trials) {
-  auto valid_moves = state->moves();
+  // Run n_playouts iterations on n_threads workers sharing the tree, or
+  // fewer if the deadline passes first. Each worker draws from its own
+  // stream split off rng.
+  void search(int n_playouts, int n_threads, Rng &rng, const Deadline &deadline = Deadline()) {
+    if (n_threads <= 1) {
+      for (int i = 0; i < n_playouts; ++i) {
+        if (i % DEADLINE_POLL == 0 && i && deadline.expired()) break;
+        play(rng);
+      }
+      return;
+    }
+
+    atomic<int> remaining(n_playouts);
+    vector<thread> workers;
+
+    for (int t = 0; t < n_threads; ++t) {
+      workers.emplace_back([this, worker_rng = rng.split(), &remaining, &deadline]() mutable {
+        for (int i = 1; remaining.fetch_sub(1, memory_order_relaxed) > 0; ++i) {
+          play(worker_rng);
+          if (i % DEADLINE_POLL == 0 && deadline.expired()) break;
+        }
+      });
+    }
+
+    for (auto &worker : workers) worker.join();
+  }
+
+  Point select_best_move() const {
+    const uint32_t first = nodes[0].first_edge;
+    assert(is_expanded(first));
+
+    double best_score = -1;
+    uint8_t best_move = PASS_SQUARE;
+
+    for (uint32_t i = first; i < first + nodes[0].n_edges; ++i) {
+      const UctNode &child = nodes[edges[i].node];
+      if (child.visits && double(child.wins) / child.visits > best_score) {
+        best_score = double(child.wins) / child.visits;
+        best_move = edges[i].move;
+      }
+    }
+
+    assert(best_score != -1);
+    if (best_move == PASS_SQUARE) return PASS;
+    return Point(SQUARE_Y(best_move), SQUARE_X(best_move));
+  }
+
+  // Each root move's share of the visits to the root's children, for
+  // game records.
+  void root_visits(RootVisits &out) const {
+    out.clear();
+    const uint32_t first = nodes[0].first_edge;
+    if (!is_expanded(first)) return;
+
+    uint64_t total = 0;
+    for (uint32_t i = first; i < first + nodes[0].n_edges; ++i) total += nodes[edges[i].node].visits;
+
+    for (uint32_t i = first; i < first + nodes[0].n_edges; ++i) {
+      const uint64_t visits = nodes[edges[i].node].visits;
+      out.push_back({ edges[i].move, uint16_t(total ? visits * 65535 / total : 0) });
+    }
+  }
+
+  // Child of node (which holds state) leading to target, or
+  // NODE_UNEXPANDED if the tree has no such child.
+  uint32_t find_child(const uint32_t index, const BoardState &state, const BoardState &target) const {
+    const uint32_t first = nodes[index].first_edge;
+    if (!is_expanded(first)) return NODE_UNEXPANDED;
+
+    BoardState child_state(state);
+    for (uint32_t i = first; i < first + nodes[index].n_edges; ++i) {
+      const Undo undo = apply(child_state, edges[i].move);
+      if (child_state == target) return edges[i].node;
+      child_state.undo(undo);
+    }
+
+    return NODE_UNEXPANDED;
+  }
+
+  // Copy the part of the tree reachable from index, whose position is
+  // state, into dst as its whole tree. Shared nodes stay shared.
+  void copy_subtree(const uint32_t index, const BoardState &state, UctTree &dst) const {
+    dst.reset(state);
+    dst.nodes[0].visits.store(nodes[index].visits, memory_order_relaxed);
+    dst.nodes[0].wins.store(nodes[index].wins, memory_order_relaxed);
+
+    struct Pending {
+      uint32_t src;
+      uint32_t dst;
+      BoardState state;
+    };
+
+    // copied[i] is node i's index in dst, NODE_UNCOPIED until it is made
+    const uint32_t NODE_UNCOPIED = 0xFFFFFFFF;
+    vector<uint32_t> copied(nodes.size, NODE_UNCOPIED);
+    vector<Pending> queue(1, Pending{ index, 0, state });
+    copied[index] = 0;
+
+    for (size_t next = 0; next < queue.size(); ++next) {
+      const Pending item = queue[next];
+      const UctNode &src = nodes[item.src];
+      UctNode &copy = dst.nodes[item.dst];
+      const uint32_t first = src.first_edge;
+
+      if (!is_expanded(first)) {
+        copy.first_edge.store(first == NODE_TERMINAL ? NODE_TERMINAL : NODE_UNEXPANDED);
+        continue;
+      }
+
+      if (!dst.nodes.has_room(src.n_edges) || !dst.edges.has_room(src.n_edges)) continue;
+
+      const uint32_t dst_first = dst.edges.allocate(src.n_edges);
+
+      for (int i = 0; i < src.n_edges; ++i) {
+        const UctEdge &edge = edges[first + i];
+
+        if (copied[edge.node] == NODE_UNCOPIED) {
+          BoardState child_state(item.state);
+          apply(child_state, edge.move);
+
+          const uint32_t child = dst.nodes.allocate(1);
+          dst.nodes[child].init();
+          dst.nodes[child].visits.store(nodes[edge.node].visits, memory_order_relaxed);
+          dst.nodes[child].wins.store(nodes[edge.node].wins, memory_order_relaxed);
+          if (dst.table.enabled()) dst.table.store(child_state.hash, child, dst.nodes);
+
+          copied[edge.node] = child;
+          queue.push_back(Pending{ edge.node, child, child_state });
+        }
 
-  BoardState * root_state = new BoardState(*state);
-  TreeNode root_node(root_state);
+        dst.edges[dst_first + i].node = copied[edge.node];
+        dst.edges[dst_first + i].move = edge.move;
+        dst.edges[dst_first + i].prior = edge.prior;
+        if (dst.amaf) {
+          dst.amaf[dst_first + i].visits.store(amaf ? amaf[first + i].visits.load() : 0, memory_order_relaxed);
+          dst.amaf[dst_first + i].wins.store(amaf ? amaf[first + i].wins.load() : 0, memory_order_relaxed);
+        }
+      }
 
-  if (root_node.n_moves) {
-    for (int i = 0; i < n_trials * root_node.n_moves; ++i) {
-      root_node.play();
+      copy.n_edges = src.n_edges;
+      copy.first_edge.store(dst_first);
     }
-    Point move = root_node.select_best_move();
-    state->apply(move);
-  } else {
+  }
+
+  void swap(UctTree &other) {
+    nodes.swap(other.nodes);
+    edges.swap(other.edges);
+    table.swap(other.table);
+    std::swap(amaf, other.amaf);
+    std::swap(root_state, other.root_state);
+    std::swap(prior, other.prior);
+    std::swap(policy, other.policy);
+  }
+
+  size_t memory_used() const {
+    return nodes.size * sizeof(UctNode) + edges.size * (sizeof(UctEdge) + (amaf ? sizeof(UctAmaf) : 0))
+         + table.memory_used();
+  }
+};
+
+// UCT search from state, guided by prior if given and loaded, with RAVE if rave and
+// rollouts played by policy. The root visits go to visits if given.
+bool uct_move(BoardState *state, int n_trials, int n_threads, Rng &rng, const TimeControl &tc = TimeControl(),
+              const PatternWeights *prior = NULL, bool rave = false, Playout policy = PLAYOUT_UNIFORM,
+              RootVisits *visits = NULL) {
+  const Deadline deadline(tc, popcount(state->empty()));
+  const int n_moves = popcount(state->move_mask());
+
+  if (n_moves == 0) {
     state->apply(PASS);
     return false;
   }
 
+  uint8_t known = book_move(*state);
+  if (known == NO_MOVE) known = endgame_move(*state);
+  if (known != NO_MOVE) {
+    state->apply_square(known);
+    return true;
+  }
+
+  const int n_playouts = n_trials * n_moves;
+  UctTree tree(*state, uct_capacity(n_playouts), true, rave);
+  tree.prior = prior && prior->loaded() ? prior : NULL;
+  tree.policy = policy;
+
+  tree.search(n_playouts, n_threads, rng, deadline);
+  if (visits) tree.root_visits(*visits);
+  state->apply(tree.select_best_move());
+
   return true;
 }
+
+// UCT player that keeps its tree between moves. After choosing a move it
+// descends into that child; on its next turn it descends again into the
+// opponent's reply, so the statistics gathered there carry over. With
+// ponder, it goes on searching below its own move on n_threads background
+// threads until its next turn, so time the opponent spends thinking
+// deepens the subtree of whatever reply comes. The root visits of each
+// search go to visits if given.
+struct UctPlayer {
+  int n_trials;
+  int n_threads;
+  RootVisits *visits;
+  UctTree tree;
+  UctTree scratch;
+
+  bool ponder;
+  atomic<bool> pondering;
+  vector<thread> ponderers;
+  atomic<uint64_t> pondered;  // playouts run while pondering
+
+  UctPlayer(int n_trials, int n_threads, bool ponder = false, RootVisits *visits = NULL)
+      : n_trials(n_trials), n_threads(n_threads), visits(visits),
+        tree(BoardState(), capacity(n_trials)),
+        scratch(BoardState(), capacity(n_trials)),
+        ponder(ponder), pondering(false), pondered(0) {}
+
+  ~UctPlayer() {
+    stop_pondering();
+  }
+
+  static uint32_t capacity(const int n_trials) {
+    // room for the largest branching factor's budget, plus what is reused
+    return uct_capacity(2 * 32 * uint64_t(n_trials));
+  }
+
+  // Search from the root in the background until stop_pondering().
+  void start_pondering(Rng &rng) {
+    pondering = true;
+    for (int t = 0; t < max(n_threads, 1); ++t) {
+      ponderers.emplace_back([this, worker_rng = rng.split()]() mutable {
+        while (pondering.load(memory_order_relaxed)) {
+          tree.play(worker_rng);
+          pondered.fetch_add(1, memory_order_relaxed);
+        }
+      });
+    }
+  }
+
+  void stop_pondering() {
+    pondering = false;
+    for (auto &ponderer : ponderers) ponderer.join();
+    ponderers.clear();
+  }
+
+  // Make the node at index the root, freeing everything else.
+  void advance(const uint32_t index, const BoardState &state) {
+    tree.copy_subtree(index, state, scratch);
+    tree.swap(scratch);
+  }
+
+  // Move the root to state if it is the root or one of its children,
+  // otherwise start a new tree. Returns the visits kept.
+  int sync(const BoardState &state) {
+    if (!(tree.root_state == state)) {
+      const uint32_t child = tree.find_child(0, tree.root_state, state);
+      if (child == NODE_UNEXPANDED) {
+        tree.reset(state);
+      } else {
+        advance(child, state);
+      }
+    }
+    return tree.root().visits;
+  }
+
+  // Pondering is worth it while the game goes on and the next position
+  // to search is not left to the endgame solver.
+  bool worth_pondering(const BoardState &state) const {
+    if (!ponder || popcount(state.empty()) - 1 <= endgame_settings.root_empties) return false;
+    BoardState after(state);
+    after.apply_pass();
+    return state.move_mask() || after.move_mask();
+  }
+
+  bool move(BoardState *state, Rng &rng, const TimeControl &tc = TimeControl()) {
+    stop_pondering();
+
+    const Deadline deadline(tc, popcount(state->empty()));
+    const int n_moves = popcount(state->move_mask());
+
+    sync(*state);
+
+    if (n_moves == 0) {
+      state->apply(PASS);
+      sync(*state);
+      if (worth_pondering(*state)) start_pondering(rng);
+      return false;
+    }
+
+    uint8_t known = book_move(*state);
+    if (known == NO_MOVE) known = endgame_move(*state);
+    if (known != NO_MOVE) {
+      state->apply_square(known);
+    } else {
+      tree.search(n_trials * n_moves, n_threads, rng, deadline);
+      if (visits) tree.root_visits(*visits);
+      state->apply(tree.select_best_move());
+    }
+    sync(*state);
+    if (worth_pondering(*state)) start_pondering(rng);
+
+    return true;
+  }
+};
+
+// The player (and its arenas) is only created on the first move.
+move_func uct_player(int n_trials, int n_threads, bool ponder = false, RootVisits *visits = NULL) {
+  auto player = make_shared<unique_ptr<UctPlayer>>();
+  return [player, n_trials, n_threads, ponder, visits](BoardState *state, const TimeControl &tc, Rng &rng) {
+    if (!*player) player->reset(new UctPlayer(n_trials, n_threads, ponder, visits));
+    return (*player)->move(state, rng, tc);
+  };
+}
@@ -3,14 +3,49 @@
 #include <vector>
 #include <functional>
 #include <cassert>
+#include <chrono>
+#include <limits>
 
-struct BoardState;
+template<int N> struct Board;
+typedef Board<8> BoardState;
+struct Rng;
 
 typedef std::pair<int,int> Point;
 
-typedef std::function<int(BoardState*, int)> eval_func;
+// clock_seconds of a game without a clock.
+const double NO_CLOCK = std::numeric_limits<double>::infinity();
 
-typedef std::function<bool(BoardState*)> move_func;
+// How long the player to move may think. move_seconds may be zero,
+// meaning no limit per move, and clock_seconds NO_CLOCK; with neither,
+// engines run their full playout or depth budget as before. A clock at
+// or below zero has run out, but still allows MIN_MOVE_SECONDS a move.
+struct TimeControl {
+  double move_seconds;
+  double clock_seconds;
+
+  TimeControl(double move_seconds = 0, double clock_seconds = NO_CLOCK)
+      : move_seconds(move_seconds), clock_seconds(clock_seconds) {}
+
+  bool limited() const {
+    return move_seconds > 0 || clock_seconds != NO_CLOCK;
+  }
+};
+
+// Strategies draw any randomness from the Rng passed in, as do the
+// evaluations, called as eval(state, player, rng). Evaluations are not
+// type-erased: the engines take their types as template parameters, so
+// leaves are evaluated without an indirect call.
+typedef std::function<bool(BoardState*, const TimeControl&, Rng&)> move_func;
+
+// A root move of a search and its share of the root visits, out of
+// 65535. Strategies made with a RootVisits sink fill it on every move
+// they search (see UctTree::root_visits), for game records.
+struct RootVisit {
+  uint8_t square;
+  uint16_t share;
+};
+
+typedef std::vector<RootVisit> RootVisits;
 
 const Point PASS = {-1,-1};
 
@@ -18,67 +53,53 @@ const Point PASS = {-1,-1};
 #define BLACK 1
 #define WHITE 2
 
+// The board BoardState and the engines play on; Board<N> (board.h) has
+// the other sizes.
 #define BOARD_W 8
 #define BOARD_H 8
 
 #define OTHER(p) (3 - (p))
 
-#define BOUNDS(y, x) ((y >= 0 && y < BOARD_H) && ((x >= 0 && x < BOARD_W)))
-
-std::vector<Point> adjacent(int y, int x) {
+#define SQUARE(y, x) ((y) * BOARD_W + (x))
+#define SQUARE_Y(sq) ((sq) / BOARD_W)
+#define SQUARE_X(sq) ((sq) % BOARD_W)
 
-  if (y > 0 && y < (BOARD_H - 1) && x > 0 && x < (BOARD_W - 1))
-    return { {y - 1, x}, {y - 1, x - 1}, {y - 1, x + 1},
-             {y, x + 1}, {y, x - 1},
-             {y + 1, x}, {y + 1, x - 1}, {y + 1, x + 1}, };
+// Least time a move is given on a clock, even one that has run out, so
+// engines can still answer with their first result.
+const double MIN_MOVE_SECONDS = 0.001;
 
-  if (y > 0 && y < (BOARD_H - 1) && x == 0)
-    return { {y - 1, x}, {y - 1, x + 1},
-             {y, x + 1}, 
-             {y + 1, x}, {y + 1, x + 1} };
+// The moment a search started under a TimeControl has to stop. The game
+// clock is spread evenly over the moves the player still has to make.
+struct Deadline {
+  typedef std::chrono::steady_clock clock;
 
-  if (y > 0 && y < (BOARD_H - 1) && x == (BOARD_W - 1))
-    return { {y - 1, x}, {y - 1, x - 1}, 
-             {y, x - 1},
-             {y + 1, x}, {y + 1, x - 1} };
+  clock::time_point end;
+  bool limited;
 
-  if (y == 0 && x > 0 && x < (BOARD_W - 1))
-    return { {y, x + 1}, {y, x - 1},
-             {y + 1, x}, {y + 1, x - 1}, {y + 1, x + 1}, };
+  Deadline() : limited(false) {}
 
-  if (y == (BOARD_H - 1) && x > 0 && x < (BOARD_W - 1))
-    return { {y - 1, x}, {y - 1, x - 1}, {y - 1, x + 1},
-             {y, x + 1}, {y, x - 1} };
+  Deadline(const TimeControl &tc, int empty_squares) : limited(false) {
+    double seconds = std::numeric_limits<double>::infinity();
 
-  if (y == 0 && x == 0)
-    return { {y + 1, x}, {y + 1, x + 1}, {y, x + 1} };
+    if (tc.move_seconds > 0) {
+      seconds = tc.move_seconds;
+    }
+    if (tc.clock_seconds != NO_CLOCK) {
+      const int moves_left = (empty_squares + 1) / 2 + 1;
+      seconds = std::min(seconds, std::max(tc.clock_seconds / moves_left, MIN_MOVE_SECONDS));
+    }
 
-  if (y == 0 && x == (BOARD_W - 1))
-    return { {y + 1, x}, {y + 1, x - 1}, {y, x - 1} };
-
-  if (y == (BOARD_H - 1) && x == 0)
-    return { {y - 1, x}, {y - 1, x + 1}, {y, x + 1} };
-
-  assert(y == (BOARD_H - 1) && x == (BOARD_W - 1));
-  return { {y - 1, x}, {y - 1, x - 1}, {y, x - 1} };
-}
-
-template<typename T>
-inline void map_adjacent(const int y, const int x, const T f) {
-
-  if (y > 0) {
-    f(y - 1, x);
-    if (x > 0) f(y - 1, x - 1);
-    if (x < (BOARD_W - 1)) f(y - 1, x + 1);
-  } 
-
-  if (y < (BOARD_H - 1)) {
-    f(y + 1, x);
-    if (x > 0) f(y + 1, x - 1);
-    if (x < (BOARD_W - 1)) f(y + 1, x + 1);
+    if (seconds != std::numeric_limits<double>::infinity()) {
+      limited = true;
+      end = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+    }
   }
 
-  if (x > 0) f(y, x - 1);
+  inline bool expired() const {
+    return limited && clock::now() >= end;
+  }
+};
 
-  if (x < (BOARD_W - 1)) f(y, x + 1);
-}
+// Checking the clock costs a few tens of nanoseconds, so hot loops poll
+// the deadline once per this many iterations.
+const int DEADLINE_POLL = 16;